@@ -0,0 +1,171 @@
+// Microbenchmarks for the scanner, the compiler and the interpreter loop.
+//
+// Built as clox_bench when CLOX_BUILD_BENCH is on. It takes the usual Google
+// Benchmark flags, so results can be kept and compared between commits with
+//
+//   clox_bench --benchmark_out=before.json --benchmark_out_format=json
+//
+// and Google Benchmark's tools/compare.py. The bundled fallback harness
+// writes the same JSON.
+
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef CLOX_MINIBENCH
+#include "minibench.hpp"
+#else
+#include <benchmark/benchmark.h>
+#endif
+
+#include "scanner.hpp"
+#include "vm.hpp"
+#include "workloads.hpp"
+
+namespace {
+
+// Statements per generated workload, and repetitions per opcode case.
+constexpr int WORKLOAD_STATEMENTS = 20000;
+constexpr int OPCODE_REPEAT = 10000;
+constexpr int INTERN_STRINGS = 4096;
+
+using clox::bench::Workload;
+
+void scan(benchmark::State &state, const std::string &source) {
+  int64_t tokens = 0;
+  for (auto _ : state) {
+    clox::Scanner scanner(source.c_str());
+    for (;;) {
+      clox::Token token = scanner.scanToken();
+      benchmark::DoNotOptimize(token);
+      tokens++;
+      if (token.type == clox::TOKEN_EOF)
+        break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(source.size()));
+  state.SetItemsProcessed(tokens);
+}
+
+// The compiler alone: the peephole pass is off.
+void compile(benchmark::State &state, const std::string &source) {
+  clox::VM vm;
+  vm.setOptimize(false);
+  for (auto _ : state) {
+    if (!vm.compile(source.c_str())) {
+      state.SkipWithError("compile error");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(source.size()));
+}
+
+// Runs a script compiled once, resetting the globals between runs.
+void run(benchmark::State &state, const std::string &source,
+         int64_t statements) {
+  clox::VM vm;
+  std::shared_ptr<const clox::Script> script = vm.compileScript(source.c_str());
+  if (!script) {
+    state.SkipWithError("compile error");
+    return;
+  }
+  for (auto _ : state) {
+    vm.reset();
+    if (vm.execute(script) != clox::INTERPRET_OK) {
+      state.SkipWithError("runtime error");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * statements);
+}
+
+std::vector<std::string> internKeys() {
+  std::vector<std::string> keys;
+  keys.reserve(INTERN_STRINGS);
+  for (int i = 0; i < INTERN_STRINGS; i++) {
+    keys.push_back(std::format("key_{}_{}", i, i * 2654435761U));
+  }
+  return keys;
+}
+
+// Looking up strings that are already interned. Storing them in globals keeps
+// them from being collected.
+void internHit(benchmark::State &state) {
+  clox::VM vm;
+  std::vector<std::string> keys = internKeys();
+  for (const std::string &key : keys) {
+    vm.defineGlobal(key, key);
+  }
+  for (auto _ : state) {
+    for (const std::string &key : keys) {
+      benchmark::DoNotOptimize(vm.copyString(key));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(keys.size()));
+}
+
+// Interning strings never seen before, which become garbage straight away.
+void internMiss(benchmark::State &state) {
+  clox::VM vm;
+  std::vector<std::string> keys = internKeys();
+  uint64_t round = 0;
+  std::string key;
+  for (auto _ : state) {
+    for (const std::string &base : keys) {
+      key.assign(base);
+      key += std::format("_{}", round);
+      benchmark::DoNotOptimize(vm.copyString(key));
+    }
+    round++;
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(keys.size()));
+}
+
+void registerBenchmarks() {
+  for (const Workload &workload :
+       clox::bench::workloads(WORKLOAD_STATEMENTS)) {
+    benchmark::RegisterBenchmark(
+        std::format("scan/{}", workload.name).c_str(),
+        [source = workload.source](benchmark::State &state) {
+          scan(state, source);
+        });
+    benchmark::RegisterBenchmark(
+        std::format("compile/{}", workload.name).c_str(),
+        [source = workload.source](benchmark::State &state) {
+          compile(state, source);
+        });
+    benchmark::RegisterBenchmark(
+        std::format("run/{}", workload.name).c_str(),
+        [source = workload.source](benchmark::State &state) {
+          run(state, source, WORKLOAD_STATEMENTS);
+        });
+  }
+
+  benchmark::RegisterBenchmark("intern/hit", internHit);
+  benchmark::RegisterBenchmark("intern/miss", internMiss);
+
+  for (const clox::bench::OpcodeCase &opcode : clox::bench::OPCODE_CASES) {
+    benchmark::RegisterBenchmark(
+        std::format("op/{}", opcode.name).c_str(),
+        [source = clox::bench::opcodeLoop(opcode, OPCODE_REPEAT)](
+            benchmark::State &state) { run(state, source, OPCODE_REPEAT); });
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  registerBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
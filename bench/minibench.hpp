@@ -0,0 +1,356 @@
+#ifndef clox_bench_minibench_h
+#define clox_bench_minibench_h
+
+// A stand-in for the part of Google Benchmark that clox_bench uses, for
+// builds where the library is neither installed nor downloadable. It
+// understands the --benchmark_filter, --benchmark_min_time,
+// --benchmark_format, --benchmark_out and --benchmark_out_format flags and
+// writes JSON in Google Benchmark's layout, so results from either harness
+// can be compared with the same tools. There are no repetitions, threads or
+// custom counters.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <print>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace benchmark {
+
+template <class T>
+inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class State {
+  int64_t maxIterations;
+  int64_t bytesProcessed = 0;
+  int64_t itemsProcessed = 0;
+  std::optional<std::string> error;
+  std::chrono::steady_clock::time_point realStart;
+  double cpuStart = 0;
+  double realSeconds = 0;
+  double cpuSeconds = 0;
+
+  static double cpuNow() {
+    timespec now{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<double>(now.tv_sec) +
+           static_cast<double>(now.tv_nsec) * 1e-9;
+  }
+
+  void start() {
+    cpuStart = cpuNow();
+    realStart = std::chrono::steady_clock::now();
+  }
+
+  void finish() {
+    realSeconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - realStart)
+                      .count();
+    cpuSeconds = cpuNow() - cpuStart;
+  }
+
+public:
+  struct [[maybe_unused]] Value {};
+
+  class Iterator {
+    State *state;
+    int64_t remaining;
+
+  public:
+    Iterator(State *state, int64_t remaining)
+        : state(state), remaining(remaining) {}
+
+    Value operator*() const { return {}; }
+
+    Iterator &operator++() {
+      remaining--;
+      return *this;
+    }
+
+    // The loop is over when this first returns false, so that is when the
+    // clock stops.
+    bool operator!=(const Iterator & /*end*/) const {
+      if (remaining > 0)
+        return true;
+      state->finish();
+      return false;
+    }
+  };
+
+  explicit State(int64_t iterations) : maxIterations(iterations) {}
+
+  Iterator begin() {
+    start();
+    return {this, maxIterations};
+  }
+
+  Iterator end() { return {this, 0}; }
+
+  [[nodiscard]] int64_t iterations() const { return maxIterations; }
+
+  void SetBytesProcessed(int64_t bytes) { bytesProcessed = bytes; }
+
+  void SetItemsProcessed(int64_t items) { itemsProcessed = items; }
+
+  void SkipWithError(std::string_view message) { error = message; }
+
+  [[nodiscard]] const std::optional<std::string> &getError() const {
+    return error;
+  }
+
+  [[nodiscard]] int64_t getBytesProcessed() const { return bytesProcessed; }
+
+  [[nodiscard]] int64_t getItemsProcessed() const { return itemsProcessed; }
+
+  [[nodiscard]] double getRealSeconds() const { return realSeconds; }
+
+  [[nodiscard]] double getCpuSeconds() const { return cpuSeconds; }
+};
+
+namespace internal {
+
+struct Benchmark {
+  std::string name;
+  std::function<void(State &)> fn;
+};
+
+struct Options {
+  std::string filter = ".";
+  double minTime = 0.5;
+  std::optional<int64_t> fixedIterations;
+  std::string format = "console";
+  std::string out;
+  std::string outFormat = "json";
+  std::string executable;
+};
+
+struct Result {
+  std::string name;
+  int64_t iterations = 0;
+  double realNs = 0;
+  double cpuNs = 0;
+  double bytesPerSecond = 0;
+  double itemsPerSecond = 0;
+  std::optional<std::string> error;
+};
+
+inline std::vector<std::unique_ptr<Benchmark>> &registry() {
+  static std::vector<std::unique_ptr<Benchmark>> benchmarks;
+  return benchmarks;
+}
+
+inline Options &options() {
+  static Options instance;
+  return instance;
+}
+
+inline std::string jsonString(std::string_view text) {
+  std::string out = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+inline Result measure(const Benchmark &benchmark) {
+  const Options &opts = options();
+  int64_t iterations = opts.fixedIterations.value_or(1);
+  for (;;) {
+    State state(iterations);
+    benchmark.fn(state);
+    if (state.getError())
+      return {.name = benchmark.name, .error = state.getError()};
+
+    double seconds = state.getRealSeconds();
+    if (opts.fixedIterations || seconds >= opts.minTime ||
+        iterations >= 1'000'000'000) {
+      auto count = static_cast<double>(iterations);
+      double cpu = state.getCpuSeconds();
+      return {
+          .name = benchmark.name,
+          .iterations = iterations,
+          .realNs = seconds * 1e9 / count,
+          .cpuNs = cpu * 1e9 / count,
+          .bytesPerSecond =
+              cpu > 0 ? static_cast<double>(state.getBytesProcessed()) / cpu
+                      : 0,
+          .itemsPerSecond =
+              cpu > 0 ? static_cast<double>(state.getItemsProcessed()) / cpu
+                      : 0,
+          .error = std::nullopt,
+      };
+    }
+
+    // Aim a little past the minimum time, growing at most tenfold per round,
+    // the way Google Benchmark does.
+    double scale = seconds > 0 ? opts.minTime * 1.4 / seconds : 10;
+    iterations = std::max(iterations + 1,
+                          static_cast<int64_t>(static_cast<double>(iterations) *
+                                               std::min(scale, 10.0)));
+  }
+}
+
+inline std::string toJson(const std::vector<Result> &results) {
+  const Options &opts = options();
+  std::string out = "{\n  \"context\": {\n";
+  std::time_t now = std::time(nullptr);
+  std::tm local{};
+  localtime_r(&now, &local);
+  char date[64];
+  std::strftime(date, sizeof(date), "%FT%T%z", &local);
+  out += std::format("    \"date\": {},\n", jsonString(date));
+  out += std::format("    \"executable\": {},\n", jsonString(opts.executable));
+  out += std::format("    \"num_cpus\": {},\n",
+                     std::thread::hardware_concurrency());
+  out += "    \"library_version\": \"clox-minibench\"\n  },\n";
+  out += "  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &result = results[i];
+    out += "    {\n";
+    out += std::format("      \"name\": {},\n", jsonString(result.name));
+    out += std::format("      \"family_index\": {},\n", i);
+    out += "      \"per_family_instance_index\": 0,\n";
+    out += std::format("      \"run_name\": {},\n", jsonString(result.name));
+    out += "      \"run_type\": \"iteration\",\n";
+    out += "      \"repetitions\": 1,\n";
+    out += "      \"repetition_index\": 0,\n";
+    out += "      \"threads\": 1,\n";
+    if (result.error) {
+      out += "      \"error_occurred\": true,\n";
+      out += std::format("      \"error_message\": {}\n",
+                         jsonString(*result.error));
+    } else {
+      out += std::format("      \"iterations\": {},\n", result.iterations);
+      out += std::format("      \"real_time\": {},\n", result.realNs);
+      out += std::format("      \"cpu_time\": {},\n", result.cpuNs);
+      out += "      \"time_unit\": \"ns\"";
+      if (result.bytesPerSecond > 0)
+        out += std::format(",\n      \"bytes_per_second\": {}",
+                           result.bytesPerSecond);
+      if (result.itemsPerSecond > 0)
+        out += std::format(",\n      \"items_per_second\": {}",
+                           result.itemsPerSecond);
+      out += "\n";
+    }
+    out += i + 1 < results.size() ? "    },\n" : "    }\n";
+  }
+  out += "  ]\n}\n";
+  return out;
+}
+
+inline void printConsole(const Result &result) {
+  if (result.error) {
+    std::println("{:<32} ERROR OCCURRED: '{}'", result.name, *result.error);
+    return;
+  }
+  std::string counters;
+  if (result.bytesPerSecond > 0)
+    counters += std::format(" bytes_per_second={:.4g}M/s",
+                            result.bytesPerSecond / 1e6);
+  if (result.itemsPerSecond > 0)
+    counters += std::format(" items_per_second={:.4g}M/s",
+                            result.itemsPerSecond / 1e6);
+  std::println("{:<32} {:>13.0f} ns {:>13.0f} ns {:>12}{}", result.name,
+               result.realNs, result.cpuNs, result.iterations, counters);
+}
+} // namespace internal
+
+template <class Fn>
+internal::Benchmark *RegisterBenchmark(const char *name, Fn &&fn) {
+  auto &registry = internal::registry();
+  registry.push_back(std::make_unique<internal::Benchmark>(
+      internal::Benchmark{.name = name, .fn = std::forward<Fn>(fn)}));
+  return registry.back().get();
+}
+
+// Consumes the flags it knows, leaving the rest in argv.
+inline void Initialize(int *argc, char **argv) {
+  internal::Options &opts = internal::options();
+  opts.executable = argv[0];
+
+  int kept = 1;
+  for (int i = 1; i < *argc; i++) {
+    std::string_view arg = argv[i];
+    auto value = [arg](std::string_view flag) -> std::optional<std::string> {
+      std::string prefix = std::format("--{}=", flag);
+      if (!arg.starts_with(prefix))
+        return std::nullopt;
+      return std::string(arg.substr(prefix.size()));
+    };
+
+    if (auto filter = value("benchmark_filter")) {
+      opts.filter = *filter;
+    } else if (auto minTime = value("benchmark_min_time")) {
+      // Either seconds ("0.5", "0.5s") or an iteration count ("100x").
+      if (minTime->ends_with('x'))
+        opts.fixedIterations = std::stoll(*minTime);
+      else
+        opts.minTime = std::stod(*minTime);
+    } else if (auto format = value("benchmark_format")) {
+      opts.format = *format;
+    } else if (auto out = value("benchmark_out")) {
+      opts.out = *out;
+    } else if (auto outFormat = value("benchmark_out_format")) {
+      opts.outFormat = *outFormat;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  *argc = kept;
+}
+
+inline bool ReportUnrecognizedArguments(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    std::println(std::cerr, "{}: error: unrecognized command-line flag: {}",
+                 argv[0], argv[i]);
+  }
+  return argc > 1;
+}
+
+inline size_t RunSpecifiedBenchmarks() {
+  const internal::Options &opts = internal::options();
+  std::regex filter(opts.filter);
+  bool console = opts.format != "json";
+
+  if (console) {
+    std::println("{:<32} {:>16} {:>16} {:>12}", "Benchmark", "Time", "CPU",
+                 "Iterations");
+  }
+  std::vector<internal::Result> results;
+  for (const auto &benchmark : internal::registry()) {
+    if (!std::regex_search(benchmark->name, filter))
+      continue;
+    results.push_back(internal::measure(*benchmark));
+    if (console)
+      internal::printConsole(results.back());
+  }
+
+  if (!console)
+    std::print("{}", internal::toJson(results));
+  if (!opts.out.empty()) {
+    std::ofstream file(opts.out);
+    file << internal::toJson(results);
+  }
+  return results.size();
+}
+
+inline void Shutdown() {}
+} // namespace benchmark
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef clox_bench_workloads_h
+#define clox_bench_workloads_h
+
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clox::bench {
+
+// A generated Lox program. Lox has no loops yet, so every workload is
+// straight-line code whose size scales with `statements`.
+struct Workload {
+  std::string name;
+  std::string source;
+};
+
+// Number arithmetic on locals, which the compiler cannot fold away.
+inline std::string arithmetic(int statements) {
+  std::string source = "{\n  var a = 1.5;\n  var b = 2;\n  var c = 0;\n";
+  for (int i = 0; i < statements; i++) {
+    source += std::format("  c = c + a * b - {} / b;\n", i % 10 + 1);
+  }
+  source += "}\n";
+  return source;
+}
+
+// Defines, reads and assigns a few dozen globals over and over.
+inline std::string globalChurn(int statements) {
+  constexpr int GLOBALS = 64;
+  std::string source;
+  for (int i = 0; i < GLOBALS; i++) {
+    source += std::format("var g{} = {};\n", i, i);
+  }
+  for (int i = 0; i < statements; i++) {
+    source += std::format("g{} = g{} + g{};\n", i % GLOBALS, (i * 7) % GLOBALS,
+                          (i * 13) % GLOBALS);
+  }
+  return source;
+}
+
+// Short concatenations that get interned, and a long string built up one
+// piece at a time.
+inline std::string concatenation(int statements) {
+  std::string source = "var p = \"ab\";\nvar q = \"cd\";\nvar s = \"\";\n";
+  for (int i = 0; i < statements; i++) {
+    if (i % 2 == 0) {
+      source += std::format("var t{} = p + q;\n", i % 32);
+    } else {
+      source += std::format("s = s + \"piece{}\";\n", i % 16);
+    }
+  }
+  return source;
+}
+
+// Blocks that declare more than 256 locals, so the later ones are reached
+// through the *_LONG instructions.
+inline std::string manyLocals(int statements) {
+  constexpr int LOCALS = 300;
+  std::string source;
+  for (int done = 0; done < statements; done += LOCALS) {
+    source += "{\n  var l0 = 0;\n";
+    for (int i = 1; i < LOCALS; i++) {
+      source += std::format("  var l{} = l{} + 1;\n", i, i - 1);
+    }
+    source += "}\n";
+  }
+  return source;
+}
+
+// Prints numbers, strings and ropes, for the output path. Run it with stdout
+// sent somewhere cheap, such as /dev/null.
+inline std::string printing(int statements) {
+  std::string source = "var s = \"a line of output\";\nvar r = s;\n";
+  for (int i = 0; i < 8; i++) {
+    source += "r = r + s;\n";
+  }
+  for (int i = 0; i < statements; i++) {
+    switch (i % 4) {
+    case 0:
+      source += std::format("print {};\n", i);
+      break;
+    case 1:
+      source += std::format("print {}.25;\n", i);
+      break;
+    case 2:
+      source += "print s;\n";
+      break;
+    default:
+      source += "print r;\n";
+      break;
+    }
+  }
+  return source;
+}
+
+inline std::vector<Workload> workloads(int statements) {
+  return {
+      {"arithmetic", arithmetic(statements)},
+      {"global_churn", globalChurn(statements)},
+      {"concatenation", concatenation(statements)},
+      {"many_locals", manyLocals(statements)},
+      {"printing", printing(statements)},
+  };
+}
+
+// A straight-line run of one statement that exercises a single instruction
+// (plus the OP_POP of the expression statement), after `setup`.
+struct OpcodeCase {
+  std::string_view name;
+  std::string_view setup;
+  std::string_view statement;
+};
+
+// clang-format off
+inline constexpr OpcodeCase OPCODE_CASES[] = {
+    {"constant",   "",                                "1;"},
+    {"get_local",  "var a = 1;",                      "a;"},
+    {"set_local",  "var a = 1;",                      "a = 2;"},
+    {"get_global", "",                                "g;"},
+    {"set_global", "",                                "g = 2;"},
+    {"add_number", "var a = 1; var b = 2;",           "a + b;"},
+    {"add_string", "var a = \"a\"; var b = \"b\";",   "a + b;"},
+    {"add_const",  "var a = 1;",                      "a + 1;"},
+    {"equal",      "var a = 1; var b = 2;",           "a == b;"},
+    {"less",       "var a = 1; var b = 2;",           "a < b;"},
+    {"negate",     "var a = 1;",                      "-a;"},
+    {"not",        "var a = true;",                   "!a;"},
+};
+// clang-format on
+
+// The statement repeated `count` times inside a block, with the setup's
+// locals in scope. `g` is always a defined global.
+inline std::string opcodeLoop(const OpcodeCase &opcode, int count) {
+  std::string source = std::format("var g = 1;\n{{\n  {}\n", opcode.setup);
+  for (int i = 0; i < count; i++) {
+    source += std::format("  {}\n", opcode.statement);
+  }
+  source += "}\n";
+  return source;
+}
+} // namespace clox::bench
+
+#endif
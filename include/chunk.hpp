@@ -1,11 +1,19 @@
 #ifndef clox_chunk_h
 #define clox_chunk_h
 
+#include <array>
+#include <bit>
+#include <cassert>
 #include <cstdint>
+#include <memory_resource>
 #include <print>
+#include <span>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "lines.hpp"
 #include "value.hpp"
 
 namespace clox {
@@ -31,38 +39,212 @@ enum OpCode : uint8_t {
   OP_NEGATE,
   OP_PRINT,
   OP_RETURN,
+  // Variants of the operand-carrying instructions above with a 24-bit
+  // little-endian operand, for chunks that outgrow one byte.
+  OP_CONSTANT_LONG,
+  OP_GET_LOCAL_LONG,
+  OP_SET_LOCAL_LONG,
+  OP_GET_GLOBAL_LONG,
+  OP_DEFINE_GLOBAL_LONG,
+  OP_SET_GLOBAL_LONG,
+  // Fused instructions, only produced by the peephole pass.
+  OP_NOT_EQUAL,
+  OP_GREATER_EQUAL,
+  OP_LESS_EQUAL,
+  OP_ADD_CONST,
+  OP_SET_LOCAL_POP,
+  OP_SET_GLOBAL_POP,
+  OP_LOCAL_ADD_CONST,
+  // Type-specialized instructions, only written by the VM over the generic
+  // one as it runs (quickening). Each checks its operand types and turns
+  // back into the generic instruction when they do not match. They never
+  // appear in a compiled Script.
+  OP_ADD_NUM,
+  OP_ADD_STR,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_GREATER_NUM,
+  OP_LESS_NUM,
+  OP_GREATER_EQUAL_NUM,
+  OP_LESS_EQUAL_NUM,
 };
 
+// One past the last opcode; keep it in step with the enum.
+inline constexpr uint8_t OPCODE_COUNT = OP_LESS_EQUAL_NUM + 1;
+
+// Indexed by opcode; keep it in step with the enum too.
+inline constexpr auto OPCODE_NAMES = std::to_array<std::string_view>({
+    "OP_CONSTANT",        "OP_NIL",
+    "OP_TRUE",            "OP_FALSE",
+    "OP_POP",             "OP_GET_LOCAL",
+    "OP_SET_LOCAL",       "OP_GET_GLOBAL",
+    "OP_DEFINE_GLOBAL",   "OP_SET_GLOBAL",
+    "OP_EQUAL",           "OP_GREATER",
+    "OP_LESS",            "OP_ADD",
+    "OP_SUBTRACT",        "OP_MULTIPLY",
+    "OP_DIVIDE",          "OP_NOT",
+    "OP_NEGATE",          "OP_PRINT",
+    "OP_RETURN",          "OP_CONSTANT_LONG",
+    "OP_GET_LOCAL_LONG",  "OP_SET_LOCAL_LONG",
+    "OP_GET_GLOBAL_LONG", "OP_DEFINE_GLOBAL_LONG",
+    "OP_SET_GLOBAL_LONG", "OP_NOT_EQUAL",
+    "OP_GREATER_EQUAL",   "OP_LESS_EQUAL",
+    "OP_ADD_CONST",       "OP_SET_LOCAL_POP",
+    "OP_SET_GLOBAL_POP",  "OP_LOCAL_ADD_CONST",
+    "OP_ADD_NUM",         "OP_ADD_STR",
+    "OP_SUBTRACT_NUM",    "OP_MULTIPLY_NUM",
+    "OP_DIVIDE_NUM",      "OP_GREATER_NUM",
+    "OP_LESS_NUM",        "OP_GREATER_EQUAL_NUM",
+    "OP_LESS_EQUAL_NUM",
+});
+static_assert(OPCODE_NAMES.size() == OPCODE_COUNT);
+
+// Total size of an instruction, opcode included.
+[[nodiscard]] constexpr size_t instructionSize(uint8_t instruction) {
+  switch (instruction) {
+  case OP_CONSTANT:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_ADD_CONST:
+  case OP_SET_LOCAL_POP:
+  case OP_SET_GLOBAL_POP:
+    return 2;
+  case OP_LOCAL_ADD_CONST:
+    return 3;
+  case OP_CONSTANT_LONG:
+  case OP_GET_LOCAL_LONG:
+  case OP_SET_LOCAL_LONG:
+  case OP_GET_GLOBAL_LONG:
+  case OP_DEFINE_GLOBAL_LONG:
+  case OP_SET_GLOBAL_LONG:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+// Whether the instruction is a quickened form of another.
+[[nodiscard]] constexpr bool isQuickened(uint8_t instruction) {
+  return instruction >= OP_ADD_NUM && instruction < OPCODE_COUNT;
+}
+
+// Whether the instruction's operand is a global slot.
+[[nodiscard]] constexpr bool isGlobalInstruction(uint8_t instruction) {
+  switch (instruction) {
+  case OP_GET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_SET_GLOBAL_POP:
+  case OP_GET_GLOBAL_LONG:
+  case OP_DEFINE_GLOBAL_LONG:
+  case OP_SET_GLOBAL_LONG:
+    return true;
+  default:
+    return false;
+  }
+}
+
 class Chunk {
   std::pmr::vector<uint8_t> code;
-  std::pmr::vector<int> lines;
+  LineTable lines;
   std::pmr::vector<Value> constants;
+  // Where each number (by bit pattern, so 0 and -0 stay apart) and each
+  // interned string already sits in `constants`.
+  std::pmr::unordered_map<uint64_t, size_t> numberConstants;
+  std::pmr::unordered_map<const Obj *, size_t> objectConstants;
 
 public:
   using allocator_type = std::pmr::polymorphic_allocator<>;
 
   Chunk() = default;
   explicit Chunk(const allocator_type &allocator)
-      : code(allocator), lines(allocator), constants(allocator) {}
+      : code(allocator), lines(allocator), constants(allocator),
+        numberConstants(allocator), objectConstants(allocator) {}
 
   allocator_type get_allocator() const { return code.get_allocator(); }
 
   [[nodiscard]] uint8_t getCode(size_t index) const { return code[index]; }
 
-  [[nodiscard]] int getLine(size_t index) const { return lines[index]; }
+  // Reads the operand of a *_LONG instruction starting at `index`.
+  [[nodiscard]] uint32_t getLong(size_t index) const {
+    return code[index] | (code[index + 1] << 8) | (code[index + 2] << 16);
+  }
+
+  [[nodiscard]] std::span<const uint8_t> codeBytes() const { return code; }
+
+  [[nodiscard]] const LineTable &getLines() const { return lines; }
+
+  [[nodiscard]] SourceLocation getLocation(size_t index) const {
+    return lines.getLocation(index);
+  }
+
+  [[nodiscard]] int getLine(size_t index) const {
+    return lines.getLocation(index).line;
+  }
 
   [[nodiscard]] Value getConstant(size_t index) const {
     return constants[index];
   }
 
-  void write(uint8_t byte, int line) {
+  [[nodiscard]] size_t constantCount() const { return constants.size(); }
+
+  [[nodiscard]] size_t size() const { return code.size(); }
+
+  void write(uint8_t byte, SourceLocation location) {
     code.push_back(byte);
-    lines.push_back(line);
+    lines.add(location);
+  }
+
+  // Swaps in rewritten bytecode, e.g. from the peephole pass. `newLines` must
+  // cover every byte of `newCode`.
+  void replaceCode(std::pmr::vector<uint8_t> &&newCode, LineTable &&newLines) {
+    code = std::move(newCode);
+    lines = std::move(newLines);
+  }
+
+  // Overwrites the opcode at `index` with another of the same size, for
+  // quickening while the chunk runs.
+  void patch(size_t index, uint8_t op) {
+    assert(instructionSize(code[index]) == instructionSize(op));
+    code[index] = op;
+  }
+
+  // Drops every instruction from `size` on, e.g. operands the compiler has
+  // just folded away.
+  void truncate(size_t size) {
+    code.resize(size);
+    lines.truncate(size);
   }
 
+  // Returns the index of `value` in the pool, adding it only if an equal
+  // number or the same string is not already there.
   size_t addConstant(Value value) {
+    size_t index = constants.size();
+    if (value.isNumber()) {
+      auto [it, inserted] = numberConstants.try_emplace(
+          std::bit_cast<uint64_t>(value.asNumber()), index);
+      if (!inserted)
+        return it->second;
+    } else if (value.isObj()) {
+      auto [it, inserted] = objectConstants.try_emplace(value.asObj(), index);
+      if (!inserted)
+        return it->second;
+    }
     constants.push_back(value);
-    return constants.size() - 1;
+    return index;
+  }
+
+  void removeLastConstant() {
+    Value value = constants.back();
+    if (value.isNumber())
+      numberConstants.erase(std::bit_cast<uint64_t>(value.asNumber()));
+    else if (value.isObj())
+      objectConstants.erase(value.asObj());
+    constants.pop_back();
   }
 
   void disassemble(std::string_view name) const {
@@ -79,6 +261,12 @@ public:
     return offset + 2;
   }
 
+  size_t constantLongInstruction(std::string_view name, size_t offset) const {
+    uint32_t constant = getLong(offset + 1);
+    std::println("{:<16} {:4} '{}'", name, constant, constants[constant]);
+    return offset + 4;
+  }
+
   size_t simpleInstruction(std::string_view name, size_t offset) const {
     std::println("{}", name);
     return offset + 1;
@@ -90,13 +278,27 @@ public:
     return offset + 2;
   }
 
+  size_t longInstruction(std::string_view name, size_t offset) const {
+    uint32_t slot = getLong(offset + 1);
+    std::println("{:<16} {:4}", name, slot);
+    return offset + 4;
+  }
+
+  size_t localConstantInstruction(std::string_view name, size_t offset) const {
+    uint8_t slot = code[offset + 1];
+    uint8_t constant = code[offset + 2];
+    std::println("{:<16} {:4} {:4} '{}'", name, slot, constant,
+                 constants[constant]);
+    return offset + 3;
+  }
+
   size_t disassembleInstruction(size_t offset) const {
     std::print("{:04} ", offset);
 
-    if (offset > 0 && lines[offset] == lines[offset - 1]) {
+    if (offset > 0 && getLine(offset) == getLine(offset - 1)) {
       std::print("   | ");
     } else {
-      std::print("{:4} ", lines[offset]);
+      std::print("{:4} ", getLine(offset));
     }
 
     uint8_t instruction = code[offset];
@@ -116,11 +318,11 @@ public:
     case OP_SET_LOCAL:
       return byteInstruction("OP_SET_LOCAL", offset);
     case OP_GET_GLOBAL:
-      return constantInstruction("OP_GET_GLOBAL", offset);
+      return byteInstruction("OP_GET_GLOBAL", offset);
     case OP_DEFINE_GLOBAL:
-      return constantInstruction("OP_DEFINE_GLOBAL", offset);
+      return byteInstruction("OP_DEFINE_GLOBAL", offset);
     case OP_SET_GLOBAL:
-      return constantInstruction("OP_SET_GLOBAL", offset);
+      return byteInstruction("OP_SET_GLOBAL", offset);
     case OP_EQUAL:
       return simpleInstruction("OP_EQUAL", offset);
     case OP_GREATER:
@@ -143,6 +345,50 @@ public:
       return simpleInstruction("OP_PRINT", offset);
     case OP_RETURN:
       return simpleInstruction("OP_RETURN", offset);
+    case OP_CONSTANT_LONG:
+      return constantLongInstruction("OP_CONSTANT_LONG", offset);
+    case OP_GET_LOCAL_LONG:
+      return longInstruction("OP_GET_LOCAL_LONG", offset);
+    case OP_SET_LOCAL_LONG:
+      return longInstruction("OP_SET_LOCAL_LONG", offset);
+    case OP_GET_GLOBAL_LONG:
+      return longInstruction("OP_GET_GLOBAL_LONG", offset);
+    case OP_DEFINE_GLOBAL_LONG:
+      return longInstruction("OP_DEFINE_GLOBAL_LONG", offset);
+    case OP_SET_GLOBAL_LONG:
+      return longInstruction("OP_SET_GLOBAL_LONG", offset);
+    case OP_NOT_EQUAL:
+      return simpleInstruction("OP_NOT_EQUAL", offset);
+    case OP_GREATER_EQUAL:
+      return simpleInstruction("OP_GREATER_EQUAL", offset);
+    case OP_LESS_EQUAL:
+      return simpleInstruction("OP_LESS_EQUAL", offset);
+    case OP_ADD_CONST:
+      return constantInstruction("OP_ADD_CONST", offset);
+    case OP_SET_LOCAL_POP:
+      return byteInstruction("OP_SET_LOCAL_POP", offset);
+    case OP_SET_GLOBAL_POP:
+      return byteInstruction("OP_SET_GLOBAL_POP", offset);
+    case OP_LOCAL_ADD_CONST:
+      return localConstantInstruction("OP_LOCAL_ADD_CONST", offset);
+    case OP_ADD_NUM:
+      return simpleInstruction("OP_ADD_NUM", offset);
+    case OP_ADD_STR:
+      return simpleInstruction("OP_ADD_STR", offset);
+    case OP_SUBTRACT_NUM:
+      return simpleInstruction("OP_SUBTRACT_NUM", offset);
+    case OP_MULTIPLY_NUM:
+      return simpleInstruction("OP_MULTIPLY_NUM", offset);
+    case OP_DIVIDE_NUM:
+      return simpleInstruction("OP_DIVIDE_NUM", offset);
+    case OP_GREATER_NUM:
+      return simpleInstruction("OP_GREATER_NUM", offset);
+    case OP_LESS_NUM:
+      return simpleInstruction("OP_LESS_NUM", offset);
+    case OP_GREATER_EQUAL_NUM:
+      return simpleInstruction("OP_GREATER_EQUAL_NUM", offset);
+    case OP_LESS_EQUAL_NUM:
+      return simpleInstruction("OP_LESS_EQUAL_NUM", offset);
     default:
       std::println("Unknown opcode: {}", instruction);
       return offset + 1;
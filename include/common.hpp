@@ -1,8 +1,24 @@
 #ifndef clox_common_h
 #define clox_common_h
 
-#define DEBUG_TRACE_EXECUTION
+// #define DEBUG_TRACE_EXECUTION
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT24_COUNT (1 << 24)
+
+// Locals beyond the first 256 are addressed through the *_LONG opcodes.
+#define LOCALS_MAX (UINT16_MAX + 1)
+
+#define STACK_MAX (LOCALS_MAX + UINT8_COUNT)
+
+// The stack starts out this deep, enough for any one-byte local operand, and
+// grows on demand up to STACK_MAX.
+#define STACK_INITIAL UINT8_COUNT
+
+#define NURSERY_SIZE (256 * 1024)
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
 
 #endif
@@ -3,9 +3,14 @@
 
 #include "chunk.hpp"
 #include "common.hpp"
+#include "lexer.hpp"
 #include "scanner.hpp"
 #include "vm.hpp"
 #include <iostream>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace clox {
 
@@ -33,20 +38,35 @@ struct Parser {
 struct Local {
   Token name;
   int depth = 0;
+  // The local this one shadows, if any.
+  int shadowed = -1;
 };
 
 struct Compiler {
-  std::array<Local, UINT8_COUNT> locals;
-  int localCount = 0;
+  std::vector<Local> locals;
+  // The innermost local of each name in scope, so blocks with thousands of
+  // locals do not make resolving one a linear scan.
+  std::unordered_map<std::string_view, int> innermost;
   int scopeDepth = 0;
 };
 
+// The most recently emitted instruction that pushes a known value, i.e. an
+// OP_CONSTANT or a literal. `code[start, end)` is the instruction itself.
+// `ownsConstant` is set if emitting it appended a new constant to the pool.
+struct ConstantExpr {
+  size_t start;
+  size_t end;
+  Value value;
+  bool ownsConstant;
+};
+
 class Emitter {
   Parser parser;
   Compiler compiler;
-  Scanner scanner;
+  TokenStream scanner;
   VM &vm;
   Chunk &chunk;
+  std::optional<ConstantExpr> lastConstant;
 
 public:
   Emitter(const char *source, VM &vm)
@@ -120,27 +140,101 @@ private:
     return true;
   }
 
-  void emitByte(uint8_t byte) { chunk.write(byte, parser.previous.line); }
+  void emitByte(uint8_t byte) { emitByte(byte, parser.previous); }
+
+  // Attributes the byte to `token`, e.g. an operator whose operands have been
+  // compiled since, so runtime errors point at the operator itself.
+  void emitByte(uint8_t byte, const Token &token) {
+    chunk.write(byte, {.line = token.line, .column = token.column});
+  }
 
   void emitBytes(uint8_t byte1, uint8_t byte2) {
     emitByte(byte1);
     emitByte(byte2);
   }
 
+  void emitOperand(uint8_t op, uint8_t longOp, size_t operand) {
+    emitOperand(op, longOp, operand, parser.previous);
+  }
+
+  // Emits `op` with a one-byte operand when it fits, and its `longOp` variant
+  // with a three-byte operand otherwise.
+  void emitOperand(uint8_t op, uint8_t longOp, size_t operand,
+                   const Token &token) {
+    if (operand <= UINT8_MAX) [[likely]] {
+      emitByte(op, token);
+      emitByte(static_cast<uint8_t>(operand), token);
+      return;
+    }
+
+    emitByte(longOp, token);
+    emitByte(static_cast<uint8_t>(operand), token);
+    emitByte(static_cast<uint8_t>(operand >> 8), token);
+    emitByte(static_cast<uint8_t>(operand >> 16), token);
+  }
+
   void emitReturn() { emitByte(OP_RETURN); }
 
-  uint8_t makeConstant(Value value) {
+  size_t makeConstant(Value value) {
+    // The constant is not reachable until it is in the pool, and growing the
+    // pool may collect.
+    vm.push(value);
     size_t constant = chunk.addConstant(value);
-    if (constant > UINT8_MAX) {
+    vm.pop();
+    if (constant >= UINT24_COUNT) {
       error("Too many constants in one chunk.");
       return 0;
     }
 
-    return static_cast<uint8_t>(constant);
+    return constant;
   }
 
   void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    size_t start = chunk.size();
+    size_t poolSize = chunk.constantCount();
+    emitOperand(OP_CONSTANT, OP_CONSTANT_LONG, makeConstant(value));
+    lastConstant = ConstantExpr{.start = start,
+                                .end = chunk.size(),
+                                .value = value,
+                                .ownsConstant =
+                                    chunk.constantCount() > poolSize};
+  }
+
+  void emitLiteral(OpCode op, Value value) {
+    size_t start = chunk.size();
+    emitByte(op);
+    lastConstant = ConstantExpr{.start = start,
+                                .end = chunk.size(),
+                                .value = value,
+                                .ownsConstant = false};
+  }
+
+  // Emits a folded result, preferring the literal opcodes to a pool entry.
+  void emitFolded(Value value) {
+    if (value.isNil())
+      emitLiteral(OP_NIL, value);
+    else if (value.isBool())
+      emitLiteral(value.asBool() ? OP_TRUE : OP_FALSE, value);
+    else
+      emitConstant(value);
+  }
+
+  // The constant the code emitted so far ends with, if any. An expression
+  // that compiled to exactly this is a candidate for folding.
+  [[nodiscard]] std::optional<ConstantExpr> trailingConstant() const {
+    if (lastConstant && lastConstant->end == chunk.size())
+      return lastConstant;
+    return std::nullopt;
+  }
+
+  // Removes folded operands, most recent first, so that any constants they
+  // added can come back off the end of the pool. Operands that reused an
+  // existing entry leave the pool alone.
+  void discardConstant(const ConstantExpr &expr) {
+    chunk.truncate(expr.start);
+    if (expr.ownsConstant)
+      chunk.removeLastConstant();
+    lastConstant.reset();
   }
 
   void endCompiler() { emitReturn(); }
@@ -150,11 +244,15 @@ private:
   void endScope() {
     compiler.scopeDepth--;
 
-    while (compiler.localCount > 0 &&
-           compiler.locals[compiler.localCount - 1].depth >
-               compiler.scopeDepth) {
+    while (!compiler.locals.empty() &&
+           compiler.locals.back().depth > compiler.scopeDepth) {
       emitByte(OP_POP);
-      compiler.localCount--;
+      const Local &local = compiler.locals.back();
+      if (local.shadowed == -1)
+        compiler.innermost.erase(local.name.str);
+      else
+        compiler.innermost[local.name.str] = local.shadowed;
+      compiler.locals.pop_back();
     }
   }
 
@@ -174,6 +272,10 @@ private:
 
   void statement();
 
+  std::optional<Value> foldUnary(TokenType operatorType, Value operand);
+
+  std::optional<Value> foldBinary(TokenType operatorType, Value a, Value b);
+
   void binary(bool canAssign);
 
   void literal(bool canAssign);
@@ -192,7 +294,7 @@ private:
 
   void parsePrecedence(Precedence precedence);
 
-  uint8_t identifierConstant(Token &name);
+  size_t globalSlot(Token &name);
 
   int resolveLocal(Token &name);
 
@@ -200,11 +302,11 @@ private:
 
   void declareVariable();
 
-  uint8_t parseVariable(std::string_view errorMessage);
+  size_t parseVariable(std::string_view errorMessage);
 
   void markInitialized();
 
-  void defineVariable(uint8_t global);
+  void defineVariable(size_t global);
 
   using ParseFn = void (Emitter::*)(bool canAssign);
 
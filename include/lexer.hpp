@@ -0,0 +1,64 @@
+#ifndef clox_lexer_h
+#define clox_lexer_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "scanner.hpp"
+
+namespace clox {
+
+// A Token without its view: 16 bytes, of which the source text is found again
+// through the offset. Error tokens keep their ScanError instead of a message.
+struct PackedToken {
+  uint32_t offset;
+  uint32_t length;
+  int32_t line;
+  uint32_t column : 24;
+  uint32_t type : 6;
+  uint32_t error : 2;
+};
+
+static_assert(sizeof(PackedToken) == 16);
+static_assert(TOKEN_EOF < (1 << 6));
+
+// Lexes the whole of `source`, which is `length` bytes followed by a NUL,
+// using up to `threads` threads. The result ends with TOKEN_EOF and is the
+// same token stream Scanner would produce.
+std::vector<PackedToken> lexParallel(const char *source, size_t length,
+                                     unsigned threads);
+
+// Where the Emitter gets its tokens from. Short sources are scanned on
+// demand; large ones are lexed up front with lexParallel() and replayed.
+class TokenStream {
+  static constexpr size_t PARALLEL_MIN_SIZE = 1024 * 1024;
+  static constexpr size_t SEGMENT_MIN_SIZE = 256 * 1024;
+
+  const char *source;
+  Scanner scanner;
+  std::vector<PackedToken> tokens;
+  size_t next = 0;
+
+public:
+  explicit TokenStream(const char *source);
+
+  Token scanToken() {
+    if (tokens.empty())
+      return scanner.scanToken();
+
+    // Like Scanner, keep returning TOKEN_EOF once the end is reached.
+    const PackedToken &token = tokens[std::min(next++, tokens.size() - 1)];
+    auto type = static_cast<TokenType>(token.type);
+    return {.type = type,
+            .str = type == TOKEN_ERROR
+                       ? SCAN_ERROR_MESSAGES[token.error]
+                       : std::string_view(source + token.offset, token.length),
+            .line = token.line,
+            .column = static_cast<int>(token.column)};
+  }
+};
+} // namespace clox
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef clox_lines_h
+#define clox_lines_h
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+namespace clox {
+
+struct SourceLocation {
+  int line = 0;
+  int column = 0;
+
+  bool operator==(const SourceLocation &) const = default;
+};
+
+// Maps bytecode offsets back to source locations. Consecutive bytes with the
+// same location form a run, and each run is stored as three LEB128 varints:
+// its distance from the previous run, the zigzag-encoded line delta and the
+// column. A typical run takes three bytes, against four bytes of line number
+// per byte of code for a parallel array.
+//
+// Every CHECKPOINT_INTERVAL-th run is also kept decoded, so a lookup is a
+// binary search over the checkpoints followed by a short linear decode.
+class LineTable {
+  static constexpr size_t CHECKPOINT_INTERVAL = 16;
+
+  struct Run {
+    size_t offset = 0;
+    SourceLocation location;
+  };
+
+  struct Checkpoint {
+    Run run;
+    // Where the encoding of the run after `run` starts.
+    size_t next;
+  };
+
+  std::pmr::vector<uint8_t> encoded;
+  std::pmr::vector<Checkpoint> checkpoints;
+  size_t runCount = 0;
+  size_t codeSize = 0;
+  Run last;
+
+public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  LineTable() = default;
+  explicit LineTable(const allocator_type &allocator)
+      : encoded(allocator), checkpoints(allocator) {}
+
+  // Number of bytes of code covered.
+  [[nodiscard]] size_t size() const { return codeSize; }
+
+  // The encoded runs, for serialization.
+  [[nodiscard]] std::span<const uint8_t> runs() const { return encoded; }
+
+  // Rebuilds the table from the runs() of one covering `size` bytes. Returns
+  // false, leaving the table empty, if they do not decode to runs with
+  // increasing offsets starting at 0 and ending before `size`.
+  bool assign(std::span<const uint8_t> runs, size_t size) {
+    clear();
+    encoded.assign(runs.begin(), runs.end());
+
+    size_t position = 0;
+    while (position < encoded.size()) {
+      // Each run is three varints; make sure they end inside the buffer, and
+      // fit in a size_t, before decoding.
+      size_t end = position;
+      for (int i = 0; i < 3; i++) {
+        size_t start = end;
+        while (end < encoded.size() && (encoded[end] & 0x80) != 0)
+          end++;
+        if (end++ >= encoded.size() || end - start > 9)
+          return fail();
+      }
+
+      Run run = decode(position, last);
+      if ((runCount == 0) != (run.offset == 0) ||
+          (runCount > 0 && run.offset <= last.offset) || run.offset >= size)
+        return fail();
+      last = run;
+      if (runCount % CHECKPOINT_INTERVAL == 0)
+        checkpoints.push_back(Checkpoint{.run = run, .next = position});
+      runCount++;
+    }
+
+    if (runCount == 0 && size > 0)
+      return fail();
+    codeSize = size;
+    return true;
+  }
+
+  // Records the location of the next byte of code.
+  void add(SourceLocation location) {
+    if (codeSize == 0 || location != last.location)
+      append(Run{.offset = codeSize, .location = location});
+    codeSize++;
+  }
+
+  [[nodiscard]] SourceLocation getLocation(size_t offset) const {
+    assert(offset < codeSize);
+    auto checkpoint = std::upper_bound(
+        checkpoints.begin(), checkpoints.end(), offset,
+        [](size_t target, const Checkpoint &checkpoint) {
+          return target < checkpoint.run.offset;
+        });
+    // The first run starts at offset 0, so there is always a checkpoint at or
+    // before `offset`.
+    --checkpoint;
+
+    Run run = checkpoint->run;
+    size_t position = checkpoint->next;
+    while (position < encoded.size()) {
+      size_t next = position;
+      Run following = decode(next, run);
+      if (following.offset > offset)
+        break;
+      run = following;
+      position = next;
+    }
+    return run.location;
+  }
+
+  // Forgets the locations of every byte from `size` on.
+  void truncate(size_t size) {
+    if (size >= codeSize)
+      return;
+    if (size == 0) {
+      clear();
+      return;
+    }
+
+    // The last checkpoint that starts before `size` survives, and so do the
+    // runs after it up to the first one at or past `size`.
+    auto end = std::lower_bound(
+        checkpoints.begin(), checkpoints.end(), size,
+        [](const Checkpoint &checkpoint, size_t target) {
+          return checkpoint.run.offset < target;
+        });
+    auto checkpoint = end - 1;
+    Run run = checkpoint->run;
+    size_t position = checkpoint->next;
+    size_t count =
+        static_cast<size_t>(checkpoint - checkpoints.begin()) *
+            CHECKPOINT_INTERVAL +
+        1;
+    while (position < encoded.size()) {
+      size_t next = position;
+      Run following = decode(next, run);
+      if (following.offset >= size)
+        break;
+      run = following;
+      position = next;
+      count++;
+    }
+
+    encoded.resize(position);
+    checkpoints.erase(end, checkpoints.end());
+    runCount = count;
+    codeSize = size;
+    last = run;
+  }
+
+private:
+  void clear() {
+    encoded.clear();
+    checkpoints.clear();
+    runCount = 0;
+    codeSize = 0;
+    last = Run{};
+  }
+
+  bool fail() {
+    clear();
+    return false;
+  }
+
+  void append(const Run &run) {
+    writeVarint(run.offset - last.offset);
+    int lineDelta = run.location.line - last.location.line;
+    writeVarint((static_cast<uint32_t>(lineDelta) << 1) ^
+                static_cast<uint32_t>(lineDelta >> 31));
+    writeVarint(static_cast<uint32_t>(run.location.column));
+    last = run;
+
+    if (runCount % CHECKPOINT_INTERVAL == 0)
+      checkpoints.push_back(Checkpoint{.run = run, .next = encoded.size()});
+    runCount++;
+  }
+
+  // Decodes the run at `position`, which follows `previous`, and advances
+  // `position` past it.
+  Run decode(size_t &position, const Run &previous) const {
+    size_t delta = readVarint(position);
+    auto zigzag = static_cast<uint32_t>(readVarint(position));
+    int lineDelta = static_cast<int>((zigzag >> 1) ^ (0U - (zigzag & 1)));
+    int column = static_cast<int>(readVarint(position));
+    return Run{.offset = previous.offset + delta,
+               .location = {.line = previous.location.line + lineDelta,
+                            .column = column}};
+  }
+
+  void writeVarint(size_t value) {
+    while (value >= 0x80) {
+      encoded.push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    encoded.push_back(static_cast<uint8_t>(value));
+  }
+
+  size_t readVarint(size_t &position) const {
+    size_t value = 0;
+    for (int shift = 0;; shift += 7) {
+      uint8_t byte = encoded[position++];
+      value |= static_cast<size_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        return value;
+    }
+  }
+};
+} // namespace clox
+
+#endif
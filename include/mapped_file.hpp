@@ -0,0 +1,62 @@
+#ifndef clox_mapped_file_h
+#define clox_mapped_file_h
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+
+namespace clox {
+
+// A read-only, private mapping of a whole file.
+class MappedFile {
+  // Files at least this big are read with MADV_SEQUENTIAL, so the kernel
+  // reads ahead aggressively and drops pages behind the scanner.
+  static constexpr size_t SEQUENTIAL_MIN_SIZE = 1024 * 1024;
+
+  std::byte *data = nullptr;
+  size_t size = 0;
+  size_t mappingSize = 0;
+
+  MappedFile(std::byte *data, size_t size, size_t mappingSize)
+      : data(data), size(size), mappingSize(mappingSize) {}
+
+public:
+  // Returns nothing if the file cannot be opened or mapped.
+  static std::optional<MappedFile> map(const std::filesystem::path &path);
+
+  // Like map(), but the contents are followed by at least one NUL byte, so
+  // text() can be handed to code that expects a C string. The file must not
+  // shrink while it is mapped.
+  static std::optional<MappedFile> mapText(const std::filesystem::path &path);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+      : data(std::exchange(other.data, nullptr)),
+        size(std::exchange(other.size, 0)),
+        mappingSize(std::exchange(other.mappingSize, 0)) {}
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(mappingSize, other.mappingSize);
+    return *this;
+  }
+
+  ~MappedFile();
+
+  [[nodiscard]] std::span<const std::byte> bytes() const {
+    return {data, size};
+  }
+
+  [[nodiscard]] std::string_view text() const {
+    return {reinterpret_cast<const char *>(data), size};
+  }
+};
+} // namespace clox
+
+#endif
@@ -1,33 +1,240 @@
 #ifndef clox_memory_h
 #define clox_memory_h
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <memory_resource>
+#include <new>
+#include <string_view>
 
 namespace clox {
 
 class VM;
+class GCResource;
 
+// What an allocation is for. Objects are broken down by type. Chunks include
+// their line tables and constant pools, and the globals are the slot arrays
+// (the name-to-slot map is a table). MEMORY_OTHER is anything allocated from
+// the GCResource itself.
+enum MemoryCategory : uint8_t {
+  MEMORY_STRING,
+  MEMORY_ROPE,
+  MEMORY_CHUNK,
+  MEMORY_TABLE,
+  MEMORY_STACK,
+  MEMORY_GLOBALS,
+  MEMORY_OTHER,
+};
+
+inline constexpr size_t MEMORY_CATEGORY_COUNT = MEMORY_OTHER + 1;
+
+inline constexpr auto MEMORY_CATEGORY_NAMES = std::to_array<std::string_view>({
+    "string",
+    "rope",
+    "chunk",
+    "table",
+    "stack",
+    "globals",
+    "other",
+});
+
+static_assert(MEMORY_CATEGORY_NAMES.size() == MEMORY_CATEGORY_COUNT);
+
+// Allocations of one category, or of all of them.
+struct AllocationStats {
+  // Power-of-two size classes: bucket 0 counts allocations of one byte, and
+  // bucket i those of 2^(i-1) + 1 up to 2^i bytes. The last bucket also takes
+  // everything bigger.
+  static constexpr size_t SIZE_BUCKETS = 32;
+
+  size_t liveBytes = 0;
+  size_t peakBytes = 0;
+  uint64_t totalBytes = 0;
+  uint64_t allocations = 0;
+  uint64_t deallocations = 0;
+  std::array<uint64_t, SIZE_BUCKETS> sizes{};
+
+  static size_t sizeBucket(size_t bytes) {
+    return std::min(static_cast<size_t>(std::bit_width(bytes - 1)),
+                    SIZE_BUCKETS - 1);
+  }
+
+  void allocated(size_t bytes) {
+    liveBytes += bytes;
+    peakBytes = std::max(peakBytes, liveBytes);
+    totalBytes += bytes;
+    allocations++;
+    if (bytes != 0)
+      sizes[sizeBucket(bytes)]++;
+  }
+
+  void deallocated(size_t bytes) {
+    liveBytes -= bytes;
+    deallocations++;
+  }
+};
+
+// A snapshot of the heap. Under GENERATIONAL_GC young objects live in the
+// nursery, which is allocated once up front, so they only show up here once
+// they are promoted.
+struct MemoryStats {
+  AllocationStats total;
+  std::array<AllocationStats, MEMORY_CATEGORY_COUNT> categories;
+
+  // Prints the breakdown by category and the size histogram to stderr.
+  void report() const;
+};
+
+// Charges everything allocated through it to one category of a GCResource.
+class CategoryResource final : public std::pmr::memory_resource {
+  GCResource *owner = nullptr;
+  MemoryCategory category = MEMORY_OTHER;
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override;
+
+  bool
+  do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+public:
+  CategoryResource() = default;
+  CategoryResource(GCResource &owner, MemoryCategory category)
+      : owner(&owner), category(category) {}
+};
+
+// Every allocation the VM makes goes through here, so this is where the
+// collector gets triggered: once the heap has grown past `nextGC` bytes (or
+// on every allocation under DEBUG_STRESS_GC). It is also where the heap is
+// accounted for. Allocating from the resource itself counts as MEMORY_OTHER;
+// category() hands out a resource for each of the others.
 class GCResource final : public std::pmr::memory_resource {
+  static constexpr size_t GC_INITIAL_HEAP = 1024 * 1024;
+  static constexpr size_t GC_HEAP_GROW_FACTOR = 2;
+
   VM &vm;
+  size_t nextGC = GC_INITIAL_HEAP;
+  bool enabled = false;
+  MemoryStats stats;
+  std::array<CategoryResource, MEMORY_CATEGORY_COUNT> categories;
 
   void *do_allocate(std::size_t bytes, std::size_t alignment) override {
-    (void)vm;
-    void *p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
-    return p;
+    return allocate(MEMORY_OTHER, bytes, alignment);
   }
 
   void do_deallocate(void *p, std::size_t bytes,
                      std::size_t alignment) override {
-    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    deallocate(MEMORY_OTHER, p, bytes, alignment);
+  }
+
+  bool
+  do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+public:
+  explicit GCResource(VM &vm) : vm(vm) {
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+      categories[i] = CategoryResource(*this, static_cast<MemoryCategory>(i));
+    }
+  }
+
+  using std::pmr::memory_resource::allocate;
+  using std::pmr::memory_resource::deallocate;
+
+  void *allocate(MemoryCategory category, std::size_t bytes,
+                 std::size_t alignment);
+
+  void deallocate(MemoryCategory category, void *p, std::size_t bytes,
+                  std::size_t alignment);
+
+  // Allocations from the result are charged to `category`.
+  [[nodiscard]] std::pmr::memory_resource *category(MemoryCategory category) {
+    return &categories[category];
+  }
+
+  // Collections are held off until the VM has finished constructing the
+  // roots they walk, and while a minor collection is moving objects.
+  void enable() { enabled = true; }
+
+  void disable() { enabled = false; }
+
+  [[nodiscard]] size_t getBytesAllocated() const {
+    return stats.total.liveBytes;
+  }
+
+  [[nodiscard]] size_t getNextGC() const { return nextGC; }
+
+  [[nodiscard]] const MemoryStats &getStats() const { return stats; }
+
+  void updateThreshold() {
+    nextGC = stats.total.liveBytes * GC_HEAP_GROW_FACTOR;
+  }
+};
+
+inline void *CategoryResource::do_allocate(std::size_t bytes,
+                                           std::size_t alignment) {
+  return owner->allocate(category, bytes, alignment);
+}
+
+inline void CategoryResource::do_deallocate(void *p, std::size_t bytes,
+                                            std::size_t alignment) {
+  owner->deallocate(category, p, bytes, alignment);
+}
+
+// Fixed-size bump-pointer region that young objects are allocated from.
+// Individual frees are no-ops; survivors are copied out by a minor collection,
+// after which the whole region is reset at once.
+class Nursery final : public std::pmr::memory_resource {
+  std::unique_ptr<std::byte[]> region;
+  std::byte *top;
+  std::byte *end;
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    void *p = top;
+    auto space = static_cast<size_t>(end - top);
+    if (std::align(alignment, bytes, p, space) == nullptr)
+      throw std::bad_alloc();
+    top = static_cast<std::byte *>(p) + bytes;
+    return p;
   }
 
+  void do_deallocate(void * /*p*/, std::size_t /*bytes*/,
+                     std::size_t /*alignment*/) override {}
+
   bool
   do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
     return this == &other;
   }
 
 public:
-  explicit GCResource(VM &vm) : vm(vm) {}
+  explicit Nursery(size_t size)
+      : region(std::make_unique<std::byte[]>(size)), top(region.get()),
+        end(region.get() + size) {}
+
+  [[nodiscard]] size_t capacity() const {
+    return static_cast<size_t>(end - region.get());
+  }
+
+  // Callers check before allocating so that a full nursery turns into a minor
+  // collection rather than a bad_alloc. `bytes` should include any padding
+  // the allocation might need.
+  [[nodiscard]] bool hasRoom(size_t bytes) const {
+    return static_cast<size_t>(end - top) >= bytes;
+  }
+
+  [[nodiscard]] bool contains(const void *p) const {
+    return p >= region.get() && p < end;
+  }
+
+  void reset() { top = region.get(); }
 };
 } // namespace clox
 #endif
@@ -3,44 +3,166 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <memory_resource>
+#include <new>
 #include <print>
-#include <string>
+#include <string_view>
+#include <vector>
 
 namespace clox {
 enum ObjType : uint8_t {
   OBJ_STRING,
+  OBJ_ROPE,
 };
 
 class ObjString;
 
+// FNV-1a, computed once per string when it is created.
+[[nodiscard]] inline uint32_t hashString(std::string_view str) {
+  uint32_t hash = 2166136261U;
+  for (char c : str) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+// Objects are destroyed through VM::freeObject, which switches on `type`, so
+// there is no virtual destructor (and no vtable pointer in every object).
 class Obj {
   ObjType type;
+  bool marked = false;
 
 public:
   explicit Obj(ObjType type) : type(type) {}
 
-  virtual ~Obj() = default;
-
   [[nodiscard]] ObjType getType() const { return type; }
+
+  [[nodiscard]] bool isMarked() const { return marked; }
+
+  void setMarked(bool value) { marked = value; }
 };
 
+// A string is a single allocation: this header followed directly by the
+// null-terminated characters.
 class ObjString final : public Obj {
-  std::pmr::string str;
+  uint32_t hash;
+  size_t length;
+
+  ObjString(std::string_view sv, uint32_t hash)
+      : Obj(OBJ_STRING), hash(hash), length(sv.size()) {
+    std::memcpy(chars(), sv.data(), length);
+    chars()[length] = '\0';
+  }
+
+  char *chars() { return reinterpret_cast<char *>(this + 1); }
+
+  [[nodiscard]] const char *chars() const {
+    return reinterpret_cast<const char *>(this + 1);
+  }
+
+  [[nodiscard]] static size_t allocationSize(size_t length) {
+    return sizeof(ObjString) + length + 1;
+  }
 
 public:
   using allocator_type = std::pmr::polymorphic_allocator<>;
 
-  ObjString() : Obj(OBJ_STRING) {}
-  explicit ObjString(const allocator_type &allocator)
-      : Obj(OBJ_STRING), str(allocator) {}
-  explicit ObjString(std::string_view sv, const allocator_type &allocator = {})
-      : Obj(OBJ_STRING), str(sv, allocator) {}
+  [[nodiscard]] static ObjString *create(allocator_type allocator,
+                                         std::string_view sv, uint32_t hash) {
+    void *p =
+        allocator.allocate_bytes(allocationSize(sv.size()), alignof(ObjString));
+    return new (p) ObjString(sv, hash);
+  }
+
+  static void destroy(allocator_type allocator, ObjString *obj) {
+    size_t size = allocationSize(obj->length);
+    obj->~ObjString();
+    allocator.deallocate_bytes(obj, size, alignof(ObjString));
+  }
+
+  [[nodiscard]] size_t allocationSize() const {
+    return allocationSize(length);
+  }
+
+  [[nodiscard]] std::string_view getString() const { return {chars(), length}; }
+
+  [[nodiscard]] uint32_t getHash() const { return hash; }
+};
+// The unflattened result of concatenating two strings or ropes. The contents
+// are only materialized (and interned) into `flat` when something needs the
+// string itself; after that the children are dropped and the rope is just an
+// indirection to `flat`.
+class ObjRope final : public Obj {
+  Obj *left;
+  Obj *right;
+  ObjString *flat = nullptr;
+  size_t length;
+
+public:
+  ObjRope(Obj *left, Obj *right, size_t length)
+      : Obj(OBJ_ROPE), left(left), right(right), length(length) {}
+
+  [[nodiscard]] Obj *getLeft() const { return left; }
+
+  [[nodiscard]] Obj *getRight() const { return right; }
+
+  [[nodiscard]] ObjString *getFlat() const { return flat; }
 
-  allocator_type get_allocator() const { return str.get_allocator(); }
+  [[nodiscard]] size_t getLength() const { return length; }
 
-  const std::pmr::string &getString() const { return str; }
+  void setChildren(Obj *newLeft, Obj *newRight) {
+    left = newLeft;
+    right = newRight;
+  }
+
+  void setFlat(ObjString *str) {
+    flat = str;
+    left = nullptr;
+    right = nullptr;
+  }
+
+  // Calls `fn` on each piece of the rope's contents, in order. Ropes built by
+  // repeated appends are deep, so this walks an explicit stack rather than
+  // recursing.
+  template <class Fn>
+  void forEachPiece(Fn &&fn) const {
+    std::vector<const Obj *> pending;
+    forEachPiece(pending, fn);
+  }
+
+  // Same, with `pending` as the stack. It is left empty but keeps its
+  // capacity, so a caller that holds on to it walks later ropes without
+  // allocating.
+  template <class Fn>
+  void forEachPiece(std::vector<const Obj *> &pending, Fn &&fn) const {
+    pending.push_back(this);
+    while (!pending.empty()) {
+      const Obj *obj = pending.back();
+      pending.pop_back();
+
+      if (obj->getType() == OBJ_STRING) {
+        fn(static_cast<const ObjString *>(obj)->getString());
+        continue;
+      }
+
+      const auto *rope = static_cast<const ObjRope *>(obj);
+      if (rope->flat != nullptr) {
+        fn(rope->flat->getString());
+        continue;
+      }
+      pending.push_back(rope->right);
+      pending.push_back(rope->left);
+    }
+  }
 };
+
+[[nodiscard]] inline size_t textLength(const Obj *obj) {
+  if (obj->getType() == OBJ_STRING)
+    return static_cast<const ObjString *>(obj)->getString().size();
+  return static_cast<const ObjRope *>(obj)->getLength();
+}
 } // namespace clox
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace clox {
+
+// Post-compile pass that rewrites short instruction sequences the Emitter
+// produces into the fused opcodes at the end of OpCode:
+//
+//   OP_EQUAL, OP_NOT                        -> OP_NOT_EQUAL
+//   OP_LESS, OP_NOT                         -> OP_GREATER_EQUAL
+//   OP_GREATER, OP_NOT                      -> OP_LESS_EQUAL
+//   OP_CONSTANT k, OP_ADD                   -> OP_ADD_CONST k
+//   OP_SET_LOCAL s, OP_POP                  -> OP_SET_LOCAL_POP s
+//   OP_SET_GLOBAL g, OP_POP                 -> OP_SET_GLOBAL_POP g
+//   OP_GET_LOCAL s, OP_ADD_CONST k,
+//     OP_SET_LOCAL_POP s                    -> OP_LOCAL_ADD_CONST s k
+//
+// Only the one-byte operand forms are fused; the *_LONG instructions pass
+// through unchanged.
+//
+// The bytecode has no jumps yet, so every instruction boundary is safe to
+// fuse across. That stops being true once control flow exists.
+class Peephole {
+  struct Instruction {
+    uint8_t op;
+    std::array<uint8_t, 3> operands;
+    SourceLocation location;
+  };
+
+  Chunk &chunk;
+  std::vector<Instruction> output;
+
+public:
+  explicit Peephole(Chunk &chunk) : chunk(chunk) {}
+
+  void run();
+
+private:
+  [[nodiscard]] Instruction &back(size_t distance) {
+    return output[output.size() - 1 - distance];
+  }
+
+  [[nodiscard]] bool tailIs(std::initializer_list<uint8_t> ops) const;
+
+  bool fuseTail();
+};
+} // namespace clox
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "common.hpp"
+#include "object.hpp"
+#include "value.hpp"
+
+namespace clox {
+
+// Collects what `print` writes and hands it to the file descriptor with
+// write(2) a buffer at a time. Values are rendered straight into the buffer,
+// byte for byte as std::format would render them, so printing allocates
+// nothing once the stack it walks ropes with has grown to fit.
+//
+// Like stdio, it flushes after every line when the descriptor is a terminal.
+// Output written to stdout through stdio is flushed ahead of each write, but
+// anything written there afterwards can only come out in order if this is
+// flushed first.
+class OutputBuffer {
+  int fd;
+  std::unique_ptr<char[]> buffer;
+  size_t capacity;
+  size_t used = 0;
+  bool lineBuffered;
+  // The stack for walking ropes, kept between prints.
+  std::vector<const Obj *> ropePieces;
+
+  // Writes `bytes` that do not fit in the space left.
+  void overflow(std::string_view bytes);
+
+  void writeAll(std::string_view bytes);
+
+public:
+  explicit OutputBuffer(int fd = STDOUT_FILENO,
+                        size_t capacity = OUTPUT_BUFFER_SIZE);
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  ~OutputBuffer() { flush(); }
+
+  // Flushes, then buffers up to `newCapacity` bytes from now on. Zero writes
+  // everything through as it comes.
+  void resize(size_t newCapacity);
+
+  void write(std::string_view bytes) {
+    if (bytes.size() > capacity - used) [[unlikely]] {
+      overflow(bytes);
+      return;
+    }
+    std::memcpy(buffer.get() + used, bytes.data(), bytes.size());
+    used += bytes.size();
+  }
+
+  void write(Value value) {
+    switch (value.getType()) {
+    case VAL_BOOL:
+      write(value.asBool() ? std::string_view("true")
+                           : std::string_view("false"));
+      break;
+    case VAL_NIL:
+      write(std::string_view("nil"));
+      break;
+    case VAL_NUMBER: {
+      // Shortest round-trip form, which is what "{}" produces.
+      char digits[32];
+      char *end =
+          std::to_chars(digits, digits + sizeof(digits), value.asNumber()).ptr;
+      write(std::string_view(digits, static_cast<size_t>(end - digits)));
+      break;
+    }
+    case VAL_OBJ:
+      if (value.isRope()) {
+        value.asRope()->forEachPiece(
+            ropePieces, [this](std::string_view piece) { write(piece); });
+      } else {
+        write(value.asString()->getString());
+      }
+      break;
+    }
+  }
+
+  void endLine() {
+    write(std::string_view("\n"));
+    if (lineBuffered)
+      flush();
+  }
+
+  void flush();
+};
+} // namespace clox
+
+#endif
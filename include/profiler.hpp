@@ -0,0 +1,86 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "chunk.hpp"
+
+namespace clox {
+
+// Instrumentation for VM::run, which calls instruction() as each instruction
+// is dispatched. The loop is instantiated once per instrumentation type, so
+// the empty one costs nothing.
+struct NoProfiler {
+  void instruction(size_t /*offset*/, uint8_t /*op*/) {}
+};
+
+// Counts instructions by opcode and by source line, and charges each opcode
+// with the time until the next instruction is dispatched. Time is in TSC
+// ticks on x86 and in nanoseconds elsewhere; either way it includes the
+// profiler's own overhead, so compare opcodes against each other rather than
+// reading it as absolute cost.
+class Profiler {
+  static constexpr uint8_t NO_OPCODE = UINT8_MAX;
+  static constexpr size_t REPORT_LINES = 20;
+
+  std::array<uint64_t, OPCODE_COUNT> counts{};
+  std::array<uint64_t, OPCODE_COUNT> ticks{};
+  // Instructions executed at each offset of the chunk being run; folded into
+  // `lineCounts` when the run ends.
+  std::vector<uint64_t> offsetCounts;
+  std::unordered_map<int, uint64_t> lineCounts;
+  uint8_t current = NO_OPCODE;
+  uint64_t currentStart = 0;
+
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec time{};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast<uint64_t>(time.tv_sec) * 1'000'000'000 +
+           static_cast<uint64_t>(time.tv_nsec);
+#endif
+  }
+
+public:
+  // Name of the time unit in report().
+  static constexpr std::string_view TICK_UNIT =
+#if defined(__x86_64__) || defined(__i386__)
+      "cycles";
+#else
+      "ns";
+#endif
+
+  void start(const Chunk &chunk) {
+    offsetCounts.assign(chunk.size(), 0);
+    current = NO_OPCODE;
+  }
+
+  void instruction(size_t offset, uint8_t op) {
+    uint64_t time = now();
+    if (current != NO_OPCODE)
+      ticks[current] += time - currentStart;
+    current = op;
+    currentStart = time;
+    counts[op]++;
+    offsetCounts[offset]++;
+  }
+
+  void finish(const Chunk &chunk);
+
+  // Prints the opcodes by time spent and the busiest source lines to stderr.
+  void report() const;
+};
+} // namespace clox
+
+#endif
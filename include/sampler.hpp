@@ -0,0 +1,66 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace clox {
+
+// A sampling profiler. The VM publishes the offset of each instruction it
+// dispatches, which costs one relaxed store; a background thread wakes up
+// `rate` times a second and counts whichever offset is current. That makes it
+// cheap enough to leave on in production at the default 100 Hz.
+//
+// Samples are attributed to source lines, and to the opcode at the sampled
+// offset, when each run finishes. collapsed() renders them in the collapsed
+// stack format that flamegraph.pl reads.
+//
+// Sampling is by wall-clock time and only while a run is in progress, so time
+// spent blocked inside an instruction (a slow `print`, say) shows up too.
+class Sampler {
+  static constexpr size_t IDLE = SIZE_MAX;
+
+  std::atomic<size_t> current = IDLE;
+  // Guards everything below against the sampling thread.
+  std::mutex mutex;
+  std::condition_variable_any wakeup;
+  // Samples at each offset of the chunk being run.
+  std::vector<uint32_t> offsetSamples;
+  std::map<std::string, uint64_t> stacks;
+  std::chrono::nanoseconds interval;
+  std::jthread thread;
+
+  void sample(std::stop_token stop);
+
+public:
+  static constexpr int DEFAULT_RATE = 100;
+
+  // `rate` is in samples per second.
+  explicit Sampler(int rate = DEFAULT_RATE);
+
+  Sampler(const Sampler &) = delete;
+  Sampler &operator=(const Sampler &) = delete;
+
+  void instruction(size_t offset, uint8_t /*op*/) {
+    current.store(offset, std::memory_order_relaxed);
+  }
+
+  void start(const Chunk &chunk);
+
+  void finish(const Chunk &chunk);
+
+  // One "script;line N;OPCODE count" line per sampled line and opcode.
+  [[nodiscard]] std::string collapsed();
+};
+} // namespace clox
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef clox_scan_simd_h
+#define clox_scan_simd_h
+
+namespace clox {
+
+// Run-finding loops for the Scanner. On x86-64 they compare 16 or 32 bytes
+// at a time (SSE2, or AVX2 when the CPU has it); elsewhere they are plain
+// loops. Each stops at the NUL terminator at the latest.
+//
+// The vector paths read whole aligned blocks, which may extend past the
+// terminator but never past the page it is on.
+
+// Skips ' ', '\t', '\r' and '\n', adding the newlines to `line` and pointing
+// `lineStart` just past the last one.
+const char *skipBlank(const char *p, int &line, const char *&lineStart);
+
+// Skips letters, digits and '_'.
+const char *skipIdentifier(const char *p);
+
+const char *skipDigits(const char *p);
+
+// Returns the closing '"' (or the NUL) of the string body starting at `p`,
+// counting newlines like skipBlank.
+const char *skipStringBody(const char *p, int &line, const char *&lineStart);
+
+// Returns the '\n' (or the NUL) ending the line `p` is on.
+const char *skipToLineEnd(const char *p);
+} // namespace clox
+
+#endif
@@ -1,9 +1,13 @@
 #ifndef clox_scanner_hpp
 #define clox_scanner_hpp
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <string_view>
 
+#include "scan_simd.hpp"
+
 namespace clox {
 
 enum TokenType : uint8_t {
@@ -54,17 +58,70 @@ enum TokenType : uint8_t {
   TOKEN_EOF
 };
 
+enum ScanError : uint8_t {
+  SCAN_UNEXPECTED_CHARACTER,
+  SCAN_UNTERMINATED_STRING
+};
+
+inline constexpr std::array<std::string_view, 2> SCAN_ERROR_MESSAGES = {
+    "Unexpected character.",
+    "Unterminated string.",
+};
+
 // TODO: Reorder to minimize padding?
 struct Token {
   TokenType type;
   std::string_view str;
   int line;
+  int column;
 };
 
+// Keywords are found with a perfect hash over the first and last characters
+// and the length, checked at compile time to put every keyword in its own
+// slot.
+struct Keyword {
+  std::string_view text;
+  TokenType type = TOKEN_IDENTIFIER;
+};
+
+[[nodiscard]] constexpr size_t keywordSlot(std::string_view text) {
+  return (static_cast<unsigned char>(text.front()) +
+          5 * static_cast<unsigned char>(text.back()) + text.size()) &
+         31;
+}
+
+constexpr std::array<Keyword, 32> makeKeywordTable() {
+  constexpr Keyword KEYWORDS[] = {
+      {"and", TOKEN_AND},       {"class", TOKEN_CLASS},
+      {"else", TOKEN_ELSE},     {"false", TOKEN_FALSE},
+      {"for", TOKEN_FOR},       {"fun", TOKEN_FUN},
+      {"if", TOKEN_IF},         {"nil", TOKEN_NIL},
+      {"or", TOKEN_OR},         {"print", TOKEN_PRINT},
+      {"return", TOKEN_RETURN}, {"super", TOKEN_SUPER},
+      {"this", TOKEN_THIS},     {"true", TOKEN_TRUE},
+      {"var", TOKEN_VAR},       {"while", TOKEN_WHILE},
+  };
+
+  std::array<Keyword, 32> table{};
+  for (const Keyword &keyword : KEYWORDS) {
+    table[keywordSlot(keyword.text)] = keyword;
+  }
+  return table;
+}
+
+inline constexpr std::array<Keyword, 32> KEYWORD_TABLE = makeKeywordTable();
+
+static_assert(std::ranges::count_if(KEYWORD_TABLE, [](const Keyword &k) {
+                return k.type != TOKEN_IDENTIFIER;
+              }) == 16,
+              "keywordSlot() maps two keywords to the same slot");
+
 class Scanner {
   const char *start;
   const char *current;
+  const char *lineStart;
   int line = 1;
+  int column = 1;
 
   [[nodiscard]] static bool isAlpha(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
@@ -73,11 +130,25 @@ class Scanner {
   [[nodiscard]] static bool isDigit(char c) { return c >= '0' && c <= '9'; }
 
 public:
-  explicit Scanner(const char *source) : start(source), current(source) {}
+  explicit Scanner(const char *source)
+      : start(source), current(source), lineStart(source) {}
+
+  // Resumes scanning at `position`, which must be between tokens, on line
+  // `line` starting at `lineStart`.
+  Scanner(const char *position, int line, const char *lineStart)
+      : start(position), current(position), lineStart(lineStart),
+        line(line) {}
+
+  // The source text of the last token scanned, including for error tokens,
+  // whose `str` is the message instead.
+  [[nodiscard]] std::string_view lexeme() const {
+    return {start, static_cast<size_t>(current - start)};
+  }
 
   Token scanToken() {
     skipWhitespace();
     start = current;
+    column = static_cast<int>(start - lineStart) + 1;
 
     if (isAtEnd())
       return makeToken(TOKEN_EOF);
@@ -127,7 +198,7 @@ public:
       break;
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(SCAN_UNEXPECTED_CHARACTER);
   }
 
 private:
@@ -158,138 +229,55 @@ private:
   [[nodiscard]] Token makeToken(TokenType type) const {
     return {.type = type,
             .str = {start, static_cast<size_t>(current - start)},
-            .line = line};
+            .line = line,
+            .column = column};
   }
 
-  [[nodiscard]] Token errorToken(std::string_view message) const {
-    return {.type = TOKEN_ERROR, .str = message, .line = line};
+  [[nodiscard]] Token errorToken(ScanError error) const {
+    return {.type = TOKEN_ERROR,
+            .str = SCAN_ERROR_MESSAGES[error],
+            .line = line,
+            .column = column};
   }
 
   void skipWhitespace() {
     for (;;) {
-      char c = peek();
-      switch (c) {
-      case ' ':
-      case '\r':
-      case '\t':
-        advance();
-        break;
-      case '\n':
-        line++;
-        advance();
-        break;
-      case '/':
-        if (peekNext() == '/') {
-          // A comment goes until the end of the line.
-          while (peek() != '\n' && !isAtEnd())
-            advance();
-        } else {
-          return;
-        }
-        break;
-      default:
+      current = skipBlank(current, line, lineStart);
+      if (peek() != '/' || peekNext() != '/')
         return;
-      }
+      // A comment goes until the end of the line.
+      current = skipToLineEnd(current + 2);
     }
   }
 
-  [[nodiscard]] TokenType checkKeyword(int offset, int length,
-                                       std::string_view rest,
-                                       TokenType type) const {
-    if (current - start == offset + length &&
-        std::string_view(start + offset, length) == rest)
-      return type;
-    return TOKEN_IDENTIFIER;
-  }
-
   [[nodiscard]] TokenType identifierType() const {
-    switch (start[0]) {
-    case 'a':
-      return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c':
-      return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-    case 'e':
-      return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-    case 'f':
-      if (current - start > 1) {
-        switch (start[1]) {
-        case 'a':
-          return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-        case 'o':
-          return checkKeyword(2, 1, "r", TOKEN_FOR);
-        case 'u':
-          return checkKeyword(2, 1, "n", TOKEN_FUN);
-        default:
-          break;
-        }
-      }
-      break;
-    case 'i':
-      return checkKeyword(1, 1, "f", TOKEN_IF);
-    case 'n':
-      return checkKeyword(1, 2, "il", TOKEN_NIL);
-    case 'o':
-      return checkKeyword(1, 1, "r", TOKEN_OR);
-    case 'p':
-      return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r':
-      return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's':
-      return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-    case 't':
-      if (current - start > 1) {
-        switch (start[1]) {
-        case 'h':
-          return checkKeyword(2, 2, "is", TOKEN_THIS);
-        case 'r':
-          return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-        default:
-          break;
-        }
-      }
-      break;
-    case 'v':
-      return checkKeyword(1, 2, "ar", TOKEN_VAR);
-    case 'w':
-      return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-    default:
-      break;
-    }
-
-    return TOKEN_IDENTIFIER;
+    std::string_view text(start, static_cast<size_t>(current - start));
+    const Keyword &keyword = KEYWORD_TABLE[keywordSlot(text)];
+    return keyword.text == text ? keyword.type : TOKEN_IDENTIFIER;
   }
 
   Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek()))
-      advance();
+    current = skipIdentifier(current);
     return makeToken(identifierType());
   }
 
   Token number() {
-    while (isDigit(peek()))
-      advance();
+    current = skipDigits(current);
 
     // Look for a fractional part.
     if (peek() == '.' && isDigit(peekNext())) {
-      // Consume the ".".
-      advance();
-
-      while (isDigit(peek()))
-        advance();
+      // Consume the "." and the digits after it.
+      current = skipDigits(current + 1);
     }
 
     return makeToken(TOKEN_NUMBER);
   }
 
   Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-      if (peek() == '\n')
-        line++;
-      advance();
-    }
+    current = skipStringBody(current, line, lineStart);
 
     if (isAtEnd())
-      return errorToken("Unterminated string.");
+      return errorToken(SCAN_UNTERMINATED_STRING);
 
     // The closing quote.
     advance();
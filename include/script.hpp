@@ -0,0 +1,52 @@
+#ifndef clox_script_h
+#define clox_script_h
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "lines.hpp"
+
+namespace clox {
+
+// A compiled script that belongs to no VM. Constants are kept as plain
+// numbers and strings and global operands refer to `globalNames`, so the
+// same Script can be run on any number of VMs; each one links it (interns
+// the strings, maps the names onto its own global slots) the first time it
+// runs it. A Script never changes once built, so it can be shared freely,
+// across threads included.
+class Script {
+public:
+  // The compiler only makes number and string constants.
+  using Constant = std::variant<double, std::string>;
+
+private:
+  std::vector<uint8_t> code;
+  LineTable lines;
+  std::vector<Constant> constants;
+  std::vector<std::string> globalNames;
+
+public:
+  // `lines` must cover every byte of `code`.
+  Script(std::vector<uint8_t> code, LineTable lines,
+         std::vector<Constant> constants, std::vector<std::string> globalNames)
+      : code(std::move(code)), lines(std::move(lines)),
+        constants(std::move(constants)), globalNames(std::move(globalNames)) {}
+
+  [[nodiscard]] const std::vector<uint8_t> &getCode() const { return code; }
+
+  [[nodiscard]] const LineTable &getLines() const { return lines; }
+
+  [[nodiscard]] const std::vector<Constant> &getConstants() const {
+    return constants;
+  }
+
+  [[nodiscard]] const std::vector<std::string> &getGlobalNames() const {
+    return globalNames;
+  }
+};
+} // namespace clox
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef clox_serializer_h
+#define clox_serializer_h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "script.hpp"
+
+namespace clox {
+
+// Bumped whenever the file layout changes, which makes every existing .loxc
+// file stale. Files also record which instruction set they were written for,
+// so changes to the bytecode alone need no bump.
+inline constexpr uint32_t LOXC_VERSION = 2;
+
+[[nodiscard]] uint64_t hashSource(std::string_view source);
+
+// Serializes `script` into the .loxc format.
+[[nodiscard]] std::string serializeScript(const Script &script,
+                                          uint64_t sourceHash);
+
+// Reads a Script back from `data`. Returns null if the data is malformed, was
+// written by a different LOXC_VERSION or a build with a different instruction
+// set or, when `sourceHash` is given, was compiled from a different source.
+[[nodiscard]] std::shared_ptr<const Script>
+loadScript(std::span<const std::byte> data,
+           std::optional<uint64_t> sourceHash);
+} // namespace clox
+
+#endif
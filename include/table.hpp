@@ -0,0 +1,198 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string_view>
+#include <utility>
+
+#include "object.hpp"
+#include "value.hpp"
+
+namespace clox {
+
+// An empty bucket has no key and a nil value; a tombstone has no key and a
+// true value so that probe sequences running through it keep going.
+struct Entry {
+  ObjString *key = nullptr;
+  Value value = Value::Nil();
+};
+
+// Open-addressing hash table keyed by interned strings, probed linearly and
+// grown to keep the load factor (tombstones included) at or below 3/4.
+class Table {
+  static constexpr size_t TABLE_MAX_LOAD_NUM = 3;
+  static constexpr size_t TABLE_MAX_LOAD_DEN = 4;
+  static constexpr size_t TABLE_MIN_CAPACITY = 8;
+
+  std::pmr::polymorphic_allocator<> allocator;
+  Entry *entries = nullptr;
+  size_t count = 0;
+  size_t capacity = 0;
+
+public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  Table() = default;
+  explicit Table(const allocator_type &allocator) : allocator(allocator) {}
+
+  Table(const Table &) = delete;
+  Table &operator=(const Table &) = delete;
+
+  Table(Table &&other) noexcept
+      : allocator(other.allocator),
+        entries(std::exchange(other.entries, nullptr)),
+        count(std::exchange(other.count, 0)),
+        capacity(std::exchange(other.capacity, 0)) {}
+
+  Table &operator=(Table &&) = delete;
+
+  ~Table() {
+    if (entries != nullptr)
+      allocator.deallocate_object(entries, capacity);
+  }
+
+  allocator_type get_allocator() const { return allocator; }
+
+  [[nodiscard]] Value *find(ObjString *key) const {
+    if (count == 0)
+      return nullptr;
+
+    Entry *entry = findEntry(entries, capacity, key);
+    if (entry->key == nullptr)
+      return nullptr;
+    return &entry->value;
+  }
+
+  // Returns true if `key` was not already in the table.
+  bool set(ObjString *key, Value value) {
+    if ((count + 1) * TABLE_MAX_LOAD_DEN > capacity * TABLE_MAX_LOAD_NUM) {
+      adjustCapacity(capacity < TABLE_MIN_CAPACITY ? TABLE_MIN_CAPACITY
+                                                   : capacity * 2);
+    }
+
+    Entry *entry = findEntry(entries, capacity, key);
+    bool isNewKey = entry->key == nullptr;
+    if (isNewKey && entry->value.isNil())
+      count++;
+
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+  }
+
+  bool remove(ObjString *key) {
+    if (count == 0)
+      return false;
+
+    Entry *entry = findEntry(entries, capacity, key);
+    if (entry->key == nullptr)
+      return false;
+
+    // Leave a tombstone in the entry.
+    entry->key = nullptr;
+    entry->value = Value::Bool(true);
+    return true;
+  }
+
+  // Looks a string up by its contents rather than its identity, which is how
+  // new strings get interned before an ObjString exists for them.
+  [[nodiscard]] ObjString *findString(std::string_view chars,
+                                      uint32_t hash) const {
+    if (count == 0)
+      return nullptr;
+
+    size_t index = hash & (capacity - 1);
+    for (;;) {
+      Entry &entry = entries[index];
+      if (entry.key == nullptr) {
+        // Stop if we find an empty non-tombstone entry.
+        if (entry.value.isNil())
+          return nullptr;
+      } else if (entry.key->getHash() == hash &&
+                 entry.key->getString() == chars) {
+        // We found it.
+        return entry.key;
+      }
+
+      index = (index + 1) & (capacity - 1);
+    }
+  }
+
+  // The string table holds its keys weakly: anything the collector did not
+  // mark is about to be freed, so drop it before the sweep.
+  void removeWhite() {
+    for (size_t i = 0; i < capacity; i++) {
+      Entry &entry = entries[i];
+      if (entry.key != nullptr && !entry.key->isMarked()) {
+        entry.key = nullptr;
+        entry.value = Value::Bool(true);
+      }
+    }
+  }
+
+  // Replaces each key with `fn(key)`, removing the entry if that returns null.
+  // A replacement has to hash the same as the key it replaces.
+  template <class Fn>
+  void rekey(Fn &&fn) {
+    for (size_t i = 0; i < capacity; i++) {
+      Entry &entry = entries[i];
+      if (entry.key == nullptr)
+        continue;
+
+      entry.key = fn(entry.key);
+      if (entry.key == nullptr)
+        entry.value = Value::Bool(true);
+    }
+  }
+
+private:
+  static Entry *findEntry(Entry *entries, size_t capacity, ObjString *key) {
+    size_t index = key->getHash() & (capacity - 1);
+    Entry *tombstone = nullptr;
+
+    for (;;) {
+      Entry *entry = &entries[index];
+      if (entry->key == nullptr) {
+        if (entry->value.isNil()) {
+          // Empty entry.
+          return tombstone != nullptr ? tombstone : entry;
+        }
+        // We found a tombstone.
+        if (tombstone == nullptr)
+          tombstone = entry;
+      } else if (entry->key == key) {
+        // We found the key.
+        return entry;
+      }
+
+      index = (index + 1) & (capacity - 1);
+    }
+  }
+
+  void adjustCapacity(size_t newCapacity) {
+    Entry *newEntries = allocator.allocate_object<Entry>(newCapacity);
+    std::uninitialized_fill_n(newEntries, newCapacity, Entry{});
+
+    // Tombstones are dropped on the way over, so recount.
+    count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+      Entry &entry = entries[i];
+      if (entry.key == nullptr)
+        continue;
+
+      Entry *dest = findEntry(newEntries, newCapacity, entry.key);
+      *dest = entry;
+      count++;
+    }
+
+    if (entries != nullptr)
+      allocator.deallocate_object(entries, capacity);
+    entries = newEntries;
+    capacity = newCapacity;
+  }
+};
+} // namespace clox
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <print>
 
 #include "object.hpp"
@@ -10,6 +12,118 @@ namespace clox {
 
 enum ValueType : uint8_t { VAL_BOOL, VAL_NIL, VAL_NUMBER, VAL_OBJ };
 
+#ifdef NAN_BOXING
+
+// Every non-number is stored in the payload of a quiet NaN. Objects set the
+// sign bit and keep their pointer in the low 48 bits; nil, false and true use
+// small tags instead.
+class Value {
+  static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+  static constexpr uint64_t QNAN = 0x7ffc000000000000;
+
+  static constexpr uint64_t TAG_NIL = 1;
+  static constexpr uint64_t TAG_FALSE = 2;
+  static constexpr uint64_t TAG_TRUE = 3;
+
+  static constexpr uint64_t NIL_VAL = QNAN | TAG_NIL;
+  static constexpr uint64_t FALSE_VAL = QNAN | TAG_FALSE;
+  static constexpr uint64_t TRUE_VAL = QNAN | TAG_TRUE;
+
+  uint64_t bits;
+
+public:
+  [[nodiscard]] static Value Bool(bool value) {
+    return Value(value ? TRUE_VAL : FALSE_VAL);
+  }
+
+  [[nodiscard]] static Value Nil() { return Value(NIL_VAL); }
+
+  [[nodiscard]] static Value Number(double value) {
+    return Value(std::bit_cast<uint64_t>(value));
+  }
+
+  [[nodiscard]] static Value Object(Obj *obj) {
+    return Value(SIGN_BIT | QNAN | reinterpret_cast<uintptr_t>(obj));
+  }
+
+  [[nodiscard]] bool isBool() const { return (bits | 1) == TRUE_VAL; }
+
+  [[nodiscard]] bool isNil() const { return bits == NIL_VAL; }
+
+  [[nodiscard]] bool isNumber() const { return (bits & QNAN) != QNAN; }
+
+  [[nodiscard]] bool isObj() const {
+    return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT);
+  }
+
+  [[nodiscard]] ObjType objType() const { return asObj()->getType(); }
+
+  [[nodiscard]] bool isObjType(ObjType objtype) const {
+    return isObj() && objType() == objtype;
+  }
+
+  [[nodiscard]] bool isString() const { return isObjType(OBJ_STRING); }
+
+  [[nodiscard]] bool isRope() const { return isObjType(OBJ_ROPE); }
+
+  // Anything `+` can concatenate: a string or a not-yet-flattened rope.
+  [[nodiscard]] bool isText() const { return isString() || isRope(); }
+
+  [[nodiscard]] bool isFalsey() const {
+    return bits == NIL_VAL || bits == FALSE_VAL;
+  }
+
+  [[nodiscard]] bool asBool() const {
+    assert(isBool());
+    return bits == TRUE_VAL;
+  }
+
+  [[nodiscard]] double asNumber() const {
+    assert(isNumber());
+    return std::bit_cast<double>(bits);
+  }
+
+  [[nodiscard]] Obj *asObj() const {
+    assert(isObj());
+    return reinterpret_cast<Obj *>(bits & ~(SIGN_BIT | QNAN));
+  }
+
+  [[nodiscard]] ObjString *asString() const {
+    assert(isString());
+    return static_cast<ObjString *>(asObj());
+  }
+
+  [[nodiscard]] ObjRope *asRope() const {
+    assert(isRope());
+    return static_cast<ObjRope *>(asObj());
+  }
+
+  [[nodiscard]] ValueType getType() const {
+    if (isNumber())
+      return VAL_NUMBER;
+    if (isObj())
+      return VAL_OBJ;
+    if (isNil())
+      return VAL_NIL;
+    return VAL_BOOL;
+  }
+
+  friend bool operator==(const Value &a, const Value &b) {
+    // Numbers still need IEEE semantics (NaN != NaN, 0.0 == -0.0); every other
+    // value has exactly one encoding, so comparing the bits is enough.
+    if (a.isNumber() && b.isNumber())
+      return a.asNumber() == b.asNumber();
+    return a.bits == b.bits;
+  }
+
+private:
+  explicit Value(uint64_t bits) : bits(bits) {}
+};
+
+static_assert(sizeof(Value) == sizeof(uint64_t));
+
+#else
+
 class Value {
   ValueType type;
   union {
@@ -62,6 +176,11 @@ public:
 
   [[nodiscard]] bool isString() const { return isObjType(OBJ_STRING); }
 
+  [[nodiscard]] bool isRope() const { return isObjType(OBJ_ROPE); }
+
+  // Anything `+` can concatenate: a string or a not-yet-flattened rope.
+  [[nodiscard]] bool isText() const { return isString() || isRope(); }
+
   [[nodiscard]] bool isFalsey() const {
     return isNil() || (isBool() && !asBool());
   }
@@ -86,6 +205,11 @@ public:
     return static_cast<ObjString *>(asObj());
   }
 
+  [[nodiscard]] ObjRope *asRope() const {
+    assert(isRope());
+    return static_cast<ObjRope *>(asObj());
+  }
+
   [[nodiscard]] ValueType getType() const { return type; }
 
   friend bool operator==(const Value &a, const Value &b) {
@@ -107,6 +231,8 @@ public:
 private:
   Value() = default;
 };
+
+#endif
 }; // namespace clox
 
 template <>
@@ -122,6 +248,14 @@ struct std::formatter<clox::Value> {
     case clox::VAL_NUMBER:
       return std::format_to(ctx.out(), "{}", value.asNumber());
     case clox::VAL_OBJ:
+      if (value.isRope()) {
+        // Stream the pieces rather than flattening just to print.
+        auto out = ctx.out();
+        value.asRope()->forEachPiece([&out](std::string_view piece) {
+          out = std::format_to(out, "{}", piece);
+        });
+        return out;
+      }
       return std::format_to(ctx.out(), "{}", value.asString()->getString());
     }
   }
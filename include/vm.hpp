@@ -2,13 +2,25 @@
 #define clox_vm_h
 
 #include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "chunk.hpp"
+#include "common.hpp"
 #include "memory.hpp"
 #include "object.hpp"
+#include "output.hpp"
+#include "profiler.hpp"
+#include "sampler.hpp"
+#include "script.hpp"
+#include "table.hpp"
 #include "value.hpp"
 
 namespace clox {
@@ -18,21 +30,79 @@ enum InterpretResult : uint8_t {
   INTERPRET_RUNTIME_ERROR
 };
 
+// Globals live in a flat array indexed by a slot the compiler assigns to each
+// name. `defined` stays false until an OP_DEFINE_GLOBAL runs, which is how
+// reads and assignments of undeclared names are still caught at runtime.
+//
+// `remembered` is set while the slot is in the VM's remembered set, i.e. it
+// may point into the nursery.
+struct Global {
+  Value value = Value::Nil();
+  bool defined = false;
+  bool remembered = false;
+};
+
+// Receives everything `print` writes, newlines included.
+using PrintSink = std::function<void(std::string_view)>;
+
 class VM {
+  static constexpr size_t ROPE_MIN_LENGTH = 64;
+  // Slots past what bytecode may fill, kept free for the VM's own pushes:
+  // those keep objects reachable while it allocates and never check for room.
+  static constexpr size_t ROOT_SLOTS = 4;
+
   GCResource resource;
-  std::pmr::polymorphic_allocator<> allocator;
 
   Chunk chunk;
+  // The script `chunk` was linked from, if any.
+  std::shared_ptr<const Script> linked;
+  bool optimize = true;
   size_t ip = 0;
-  std::vector<Value> stack;
+  // How deep bytecode may take the stack.
+  size_t stackMax;
+  // How deep it may go before the stack has to grow.
+  size_t stackCapacity;
+  std::pmr::vector<Value> stack;
+  Value *stackTop;
   std::vector<Obj *> objects;
-  std::pmr::unordered_map<std::string_view, ObjString *> strings;
-  std::pmr::unordered_map<ObjString *, Value> globals;
+  std::vector<Obj *> grayStack;
+  Table strings;
+  Table globalSlots;
+  std::pmr::vector<ObjString *> globalNames;
+  std::pmr::vector<Global> globals;
+  std::string scratch;
+  PrintSink printSink;
+  std::string printBuffer;
+  OutputBuffer output;
+  Profiler *profiler = nullptr;
+  Sampler *sampler = nullptr;
+#ifdef GENERATIONAL_GC
+  Nursery nursery;
+  std::pmr::polymorphic_allocator<> youngAllocator;
+  std::vector<size_t> rememberedGlobals;
+  std::vector<Obj *> markedYoung;
+  std::unordered_map<Obj *, Obj *> forwarding;
+#endif
 
 public:
-  explicit VM()
-      : resource(GCResource(*this)), allocator(&resource), chunk(allocator),
-        strings(allocator), globals(allocator) {}
+  // Scripts get a stack overflow past `stackSize` values.
+  explicit VM(size_t stackSize = STACK_MAX)
+      : resource(GCResource(*this)), chunk(allocatorFor(MEMORY_CHUNK)),
+        stackMax(stackSize),
+        stackCapacity(std::min<size_t>(stackSize, STACK_INITIAL)),
+        stack(STACK_INITIAL + ROOT_SLOTS, Value::Nil(),
+              allocatorFor(MEMORY_STACK)),
+        stackTop(stack.data()), strings(allocatorFor(MEMORY_TABLE)),
+        globalSlots(allocatorFor(MEMORY_TABLE)),
+        globalNames(allocatorFor(MEMORY_GLOBALS)),
+        globals(allocatorFor(MEMORY_GLOBALS))
+#ifdef GENERATIONAL_GC
+        ,
+        nursery(NURSERY_SIZE), youngAllocator(&nursery)
+#endif
+  {
+    resource.enable();
+  }
 
   VM(const VM &) = delete;
   VM &operator=(const VM &) = delete;
@@ -41,30 +111,105 @@ public:
 
   ~VM() {
     for (Obj *obj : objects) {
-      switch (obj->getType()) {
-      case OBJ_STRING:
-        allocator.delete_object(static_cast<ObjString *>(obj));
-        break;
-      }
+      freeObject(obj);
     }
   }
 
   InterpretResult interpret(const char *source);
 
+  // Compiles `source` into the current chunk without running it.
+  bool compile(const char *source);
+
+  // Runs the current chunk from the start.
+  InterpretResult execute();
+
+  // Compiles `source` into a Script that can be run on this VM or any other.
+  // Returns null on a compile error.
+  std::shared_ptr<const Script> compileScript(const char *source);
+
+  // Runs `script` against this VM's globals. The script is only linked the
+  // first time it runs here, so running it again (after a reset(), say) costs
+  // no more than execute().
+  InterpretResult execute(const std::shared_ptr<const Script> &script);
+
+  // Clears the stack and forgets the value of every global, so the next run
+  // starts from a clean slate. Interned strings and global slots are kept,
+  // which is what lets linked scripts stay linked.
+  void reset() {
+    resetStack();
+    for (Global &global : globals) {
+      global = Global{};
+    }
+#ifdef GENERATIONAL_GC
+    rememberedGlobals.clear();
+#endif
+  }
+
   Chunk &getChunk() { return chunk; }
 
-  void push(Value value) { stack.push_back(value); }
+  [[nodiscard]] const Chunk &getChunk() const { return chunk; }
+
+  [[nodiscard]] size_t globalCount() const { return globals.size(); }
+
+  [[nodiscard]] ObjString *globalName(size_t slot) const {
+    return globalNames[slot];
+  }
+
+  // Defines the global `name` for the scripts run next, as `var name = value;`
+  // would. Goes well with reset(), to hand each run its input.
+  void defineGlobal(std::string_view name, Value value);
+
+  // Same, with `string` interned as a Lox string.
+  void defineGlobal(std::string_view name, std::string_view string) {
+    defineGlobal(name, Value::Object(copyString(string)));
+  }
+
+  // The value of the global `name`, or nothing if it is not defined. Strings
+  // in the result stay valid until the VM next runs or allocates.
+  [[nodiscard]] std::optional<Value> findGlobal(std::string_view name) const;
+
+  // Sends the output of `print` to `sink` rather than stdout; a null sink
+  // restores stdout.
+  void setPrintSink(PrintSink sink) { printSink = std::move(sink); }
+
+  // Holds up to `bytes` of what `print` writes to stdout before writing it
+  // out; zero writes every line as it is printed. Whatever is buffered is
+  // written out when a run ends, and before a runtime error is reported.
+  void setOutputBufferSize(size_t bytes) { output.resize(bytes); }
+
+  // Writes out any buffered stdout output now.
+  void flushOutput() { output.flush(); }
+
+  // Records every run in `profiler`, which must outlive the VM or be unset
+  // with nullptr first.
+  void setProfiler(Profiler *newProfiler) { profiler = newProfiler; }
+
+  // Lets `sampler` sample every run, under the same terms as setProfiler().
+  // A Profiler takes precedence if both are set.
+  void setSampler(Sampler *newSampler) { sampler = newSampler; }
+
+  // Everything the VM has allocated so far, by category. The reference stays
+  // valid, and current, for as long as the VM lives.
+  [[nodiscard]] const MemoryStats &memoryStats() const {
+    return resource.getStats();
+  }
+
+  // Whether compiled chunks go through the peephole pass.
+  void setOptimize(bool enabled) { optimize = enabled; }
+
+  void push(Value value) {
+    assert(stackTop < stack.data() + stack.size());
+    *stackTop++ = value;
+  }
 
   [[nodiscard]] Value peek(size_t distance) const {
-    assert(distance < stack.size());
-    return stack[stack.size() - 1 - distance];
+    assert(stackTop - distance > stack.data());
+    return stackTop[-1 - static_cast<ptrdiff_t>(distance)];
   }
 
   Value pop() {
-    assert(!stack.empty());
-    Value value = stack.back();
-    stack.pop_back();
-    return value;
+    assert(stackTop > stack.data());
+    return *--stackTop;
   }
 
   template <class ValueType, class BinaryOp>
@@ -81,42 +226,345 @@ public:
 
   InterpretResult run();
 
+  // Adds the two values on top of the stack, replacing them with the sum.
+  bool add() {
+    if (peek(0).isText() && peek(1).isText()) {
+      addText();
+    } else if (peek(0).isNumber() && peek(1).isNumber()) {
+      double b = pop().asNumber();
+      double a = pop().asNumber();
+      push(Value::Number(a + b));
+    } else {
+      runtimeError("Operands must be two numbers or two strings.");
+      return false;
+    }
+    return true;
+  }
+
+  // Replaces the two text values on top of the stack with their
+  // concatenation.
+  void addText() {
+    // Leave the operands on the stack until the result exists: creating it
+    // can run the collector.
+    Obj *result = concatenate();
+    pop();
+    pop();
+    push(Value::Object(result));
+  }
+
+  // The fast path of a quickened binary instruction: applies `op` if both
+  // operands are numbers, and otherwise leaves them for the generic handler.
+  template <class ValueType, class BinaryOp>
+  bool numberOp(ValueType valueType, BinaryOp op) {
+    if (!peek(0).isNumber() || !peek(1).isNumber()) [[unlikely]]
+      return false;
+    double b = pop().asNumber();
+    double a = pop().asNumber();
+    push(valueType(op(a, b)));
+    return true;
+  }
+
+  // Pops two values and reports whether they are equal.
+  bool popEqual() {
+    // Strings compare by identity, so ropes have to be interned first. They
+    // stay on the stack until then in case flattening collects.
+    if (peek(0).isRope())
+      stackTop[-1] = Value::Object(flatten(0));
+    if (peek(1).isRope())
+      stackTop[-2] = Value::Object(flatten(1));
+
+    Value b = pop();
+    Value a = pop();
+    return a == b;
+  }
+
+  void traceInstruction() const;
+
+  // Interns `str`. The result is never in the nursery: it may end up in a
+  // chunk's constants, a global's name or a rope's contents, none of which a
+  // minor collection scans. May run a minor collection.
   ObjString *copyString(std::string_view str) {
-    if (auto it = strings.find(str); it != strings.end()) {
-      return it->second;
+    uint32_t hash = hashString(str);
+    if (ObjString *interned = strings.findString(str, hash)) {
+#ifdef GENERATIONAL_GC
+      // Concatenation interns young strings too.
+      if (nursery.contains(interned))
+        return promoteString(interned);
+#endif
+      return interned;
     }
-    return allocateString(str);
+    return allocateString(str, hash);
   }
 
-  ObjString *takeString(std::pmr::string &&str) {
-    if (auto it = strings.find(str); it != strings.end()) {
-      return it->second;
+  size_t globalSlot(ObjString *name) {
+    if (Value *slot = globalSlots.find(name)) {
+      return static_cast<size_t>(slot->asNumber());
     }
-    return allocateString(std::move(str));
+
+    // Growing the tables below can trigger a collection, and `name` may not
+    // be reachable from anywhere else yet.
+    push(Value::Object(name));
+    size_t slot = globals.size();
+    globalSlots.set(name, Value::Number(static_cast<double>(slot)));
+    globalNames.push_back(name);
+    globals.emplace_back();
+    pop();
+    return slot;
   }
 
+  void collectGarbage();
+
+#ifdef GENERATIONAL_GC
+  void minorCollect();
+#endif
+
 private:
+  void resetStack() { stackTop = stack.data(); }
+
+  template <class Instrument>
+  InterpretResult run(Instrument &instrument);
+
+  // Rebuilds `chunk` from `script` for this VM.
+  bool link(const std::shared_ptr<const Script> &script);
+
+  // Only instructions that leave the stack deeper than they found it need to
+  // check for room before pushing. Growing the stack moves it, so no pointer
+  // or reference into it may be held across this.
+  [[nodiscard]] bool checkStack() {
+    if (stackTop < stack.data() + stackCapacity) [[likely]]
+      return true;
+    return growStack();
+  }
+
+  bool growStack();
+
+  // The stack always has room for every one-byte local operand, but a
+  // *_LONG one can name any slot, so those are checked against what is
+  // actually on the stack.
+  [[nodiscard]] bool checkLocal(size_t slot) {
+    if (slot < static_cast<size_t>(stackTop - stack.data())) [[likely]]
+      return true;
+    runtimeError("Invalid local variable slot.");
+    return false;
+  }
+
+  // An allocator that charges what it allocates to `category`.
+  std::pmr::polymorphic_allocator<> allocatorFor(MemoryCategory category) {
+    return resource.category(category);
+  }
+
+  // Rewrites the one-byte instruction just read as `op`. Quickening replaces
+  // a generic instruction with a variant specialized to the operand types it
+  // just saw, and a variant whose guard fails puts the generic one back.
+  void rewrite(OpCode op) { chunk.patch(ip - 1, op); }
+
+  // Quickens the binary instruction just read to `specialized` if both
+  // operands are numbers.
+  void quickenNumbers(OpCode specialized) {
+    if (peek(0).isNumber() && peek(1).isNumber())
+      rewrite(specialized);
+  }
+
   uint8_t readByte() { return chunk.getCode(ip++); }
 
   Value readConstant() { return chunk.getConstant(readByte()); }
 
-  ObjString *readString() { return readConstant().asString(); }
+  uint32_t readLong() {
+    uint32_t operand = chunk.getLong(ip);
+    ip += 3;
+    return operand;
+  }
+
+  // Global accesses shared by the one-byte and *_LONG instruction forms.
+  bool getGlobal(size_t slot) {
+    const Global &global = globals[slot];
+    if (!global.defined) {
+      runtimeError("Undefined variable '{}'.", globalNames[slot]->getString());
+      return false;
+    }
+    push(global.value);
+    return true;
+  }
+
+  void defineGlobal(size_t slot) {
+    Global &global = globals[slot];
+    global.value = pop();
+    global.defined = true;
+    rememberGlobal(slot);
+  }
+
+  bool setGlobal(size_t slot, Value value) {
+    Global &global = globals[slot];
+    if (!global.defined) {
+      runtimeError("Undefined variable '{}'.", globalNames[slot]->getString());
+      return false;
+    }
+    global.value = value;
+    rememberGlobal(slot);
+    return true;
+  }
 
   template <typename... Args>
-  ObjString *allocateString(Args... args) {
-    auto *obj = allocator.new_object<ObjString>(args...);
+  ObjString *allocateString(Args &&...args) {
+    auto *obj = ObjString::create(allocatorFor(MEMORY_STRING),
+                                  std::forward<Args>(args)...);
     objects.push_back(obj);
-    strings.insert({obj->getString(), obj});
+#ifdef DEBUG_LOG_GC
+    std::println("{} allocate {} for {}", static_cast<void *>(obj),
+                 obj->allocationSize(), static_cast<int>(OBJ_STRING));
+#endif
+
+    push(Value::Object(obj));
+    strings.set(obj, Value::Nil());
+    pop();
     return obj;
   }
 
+  // Concatenates the two text values on top of the stack, leaving them in
+  // place. Short results are built in a reusable scratch buffer and interned,
+  // so a concatenation that finds an existing string allocates nothing.
+  // Longer ones become ropes so that repeated appends do not copy (and hash)
+  // the whole prefix every time.
+  Obj *concatenate() {
+    Obj *b = peek(0).asObj();
+    Obj *a = peek(1).asObj();
+    size_t length = textLength(a) + textLength(b);
+    if (length >= ROPE_MIN_LENGTH)
+      return allocateRope(length);
+
+    // Both operands are strings: a rope is never shorter than ROPE_MIN_LENGTH.
+    scratch.assign(static_cast<ObjString *>(a)->getString());
+    scratch.append(static_cast<ObjString *>(b)->getString());
+
+    uint32_t hash = hashString(scratch);
+    if (ObjString *interned = strings.findString(scratch, hash)) {
+      return interned;
+    }
+    return allocateYoungString(scratch, hash);
+  }
+
+  // Materializes the contents of the rope `distance` slots down the stack as
+  // an interned string.
+  ObjString *flatten(size_t distance) {
+    ObjRope *rope = peek(distance).asRope();
+    if (ObjString *flat = rope->getFlat())
+      return flat;
+
+    scratch.clear();
+    rope->forEachPiece(
+        [this](std::string_view piece) { scratch.append(piece); });
+    ObjString *flat = copyString(scratch);
+    // Interning may have promoted the rope out of the nursery.
+    peek(distance).asRope()->setFlat(flat);
+    return flat;
+  }
+
+#ifdef GENERATIONAL_GC
+  // Moves `young` out of the nursery, along with everything else live there,
+  // and returns its new address.
+  ObjString *promoteString(ObjString *young) {
+    push(Value::Object(young));
+    minorCollect();
+    return pop().asString();
+  }
+#endif
+
+  // Makes a rope of the two operands on top of the stack.
+  ObjRope *allocateRope(size_t length) {
+#ifdef GENERATIONAL_GC
+    if (!nursery.hasRoom(sizeof(ObjRope) + alignof(ObjRope)))
+      minorCollect();
+
+    // A minor collection may have moved the operands, so read them only now.
+    auto *rope = youngAllocator.new_object<ObjRope>(peek(1).asObj(),
+                                                    peek(0).asObj(), length);
+#else
+    auto *rope = allocatorFor(MEMORY_ROPE).new_object<ObjRope>(
+        peek(1).asObj(), peek(0).asObj(), length);
+    objects.push_back(rope);
+#endif
+#ifdef DEBUG_LOG_GC
+    std::println("{} allocate {} for {}", static_cast<void *>(rope),
+                 sizeof(ObjRope), static_cast<int>(OBJ_ROPE));
+#endif
+    return rope;
+  }
+
+  ObjString *allocateYoungString(std::string_view str, uint32_t hash) {
+#ifdef GENERATIONAL_GC
+    // Room for the object, its characters and alignment padding.
+    size_t size = sizeof(ObjString) + str.size() + 1 + alignof(ObjString);
+    if (size > nursery.capacity() / 8)
+      return allocateString(str, hash);
+    if (!nursery.hasRoom(size))
+      minorCollect();
+
+    auto *obj = ObjString::create(youngAllocator, str, hash);
+#ifdef DEBUG_LOG_GC
+    std::println("{} allocate young {} for {}", static_cast<void *>(obj),
+                 obj->allocationSize(), static_cast<int>(OBJ_STRING));
+#endif
+
+    push(Value::Object(obj));
+    strings.set(obj, Value::Nil());
+    pop();
+    return obj;
+#else
+    return allocateString(str, hash);
+#endif
+  }
+
+  // Write barrier for stores into globals: slots that pick up a young object
+  // are remembered so minor collections need not scan every global.
+  void rememberGlobal([[maybe_unused]] size_t slot) {
+#ifdef GENERATIONAL_GC
+    Global &global = globals[slot];
+    if (!global.remembered && global.value.isObj() &&
+        nursery.contains(global.value.asObj())) {
+      global.remembered = true;
+      rememberedGlobals.push_back(slot);
+    }
+#endif
+  }
+
+  void freeObject(Obj *obj);
+
+  void markObject(Obj *obj);
+
+  void markValue(Value value);
+
+  void markRoots();
+
+  void blackenObject(Obj *obj);
+
+  void traceReferences();
+
+  void sweep();
+
+  void print(Value value) {
+    if (!printSink) {
+      output.write(value);
+      output.endLine();
+#ifdef DEBUG_TRACE_EXECUTION
+      // The trace goes through stdio, so keep the two in order.
+      output.flush();
+#endif
+      return;
+    }
+    printBuffer.clear();
+    std::format_to(std::back_inserter(printBuffer), "{}\n", value);
+    printSink(printBuffer);
+  }
+
   template <typename... Args>
   void runtimeError(std::format_string<Args...> fmt, Args &&...args) {
+    output.flush();
     std::println(std::cerr, fmt, std::forward<decltype(args)>(args)...);
 
-    int line = chunk.getLine(ip - 1);
-    std::println(std::cerr, "[line {}] in script", line);
-    stack.clear();
+    SourceLocation location = chunk.getLocation(ip - 1);
+    std::println(std::cerr, "[line {}, column {}] in script", location.line,
+                 location.column);
+    resetStack();
   }
 };
 
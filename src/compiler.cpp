@@ -1,4 +1,5 @@
 #include <print>
+#include <utility>
 
 #include "compiler.hpp"
 #include "scanner.hpp"
@@ -16,7 +17,7 @@ void Emitter::block() {
 }
 
 void Emitter::varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+  size_t global = parseVariable("Expect variable name.");
 
   if (match(TOKEN_EQUAL)) {
     expression();
@@ -88,41 +89,114 @@ void Emitter::statement() {
   }
 }
 
+std::optional<Value> Emitter::foldUnary(TokenType operatorType,
+                                        Value operand) {
+  switch (operatorType) {
+  case TOKEN_BANG:
+    return Value::Bool(operand.isFalsey());
+  case TOKEN_MINUS:
+    // Negating a non-number stays a runtime error.
+    if (operand.isNumber())
+      return Value::Number(-operand.asNumber());
+    return std::nullopt;
+  default:
+    return std::nullopt;
+  }
+}
+
+std::optional<Value> Emitter::foldBinary(TokenType operatorType, Value a,
+                                         Value b) {
+  // Constant strings are interned, so comparing the values is exact.
+  if (operatorType == TOKEN_EQUAL_EQUAL)
+    return Value::Bool(a == b);
+  if (operatorType == TOKEN_BANG_EQUAL)
+    return Value::Bool(!(a == b));
+
+  if (operatorType == TOKEN_PLUS && a.isString() && b.isString()) {
+    std::string result(a.asString()->getString());
+    result += b.asString()->getString();
+    return Value::Object(vm.copyString(result));
+  }
+
+  // Everything else needs two numbers; otherwise leave the error to runtime.
+  if (!a.isNumber() || !b.isNumber())
+    return std::nullopt;
+
+  double x = a.asNumber();
+  double y = b.asNumber();
+  switch (operatorType) {
+  case TOKEN_GREATER:
+    return Value::Bool(x > y);
+  case TOKEN_GREATER_EQUAL:
+    return Value::Bool(!(x < y));
+  case TOKEN_LESS:
+    return Value::Bool(x < y);
+  case TOKEN_LESS_EQUAL:
+    return Value::Bool(!(x > y));
+  case TOKEN_PLUS:
+    return Value::Number(x + y);
+  case TOKEN_MINUS:
+    return Value::Number(x - y);
+  case TOKEN_STAR:
+    return Value::Number(x * y);
+  case TOKEN_SLASH:
+    return Value::Number(x / y);
+  default:
+    return std::nullopt;
+  }
+}
+
 void Emitter::binary(bool /*canAssign*/) {
-  TokenType operatorType = parser.previous.type;
+  Token operatorToken = parser.previous;
+  TokenType operatorType = operatorToken.type;
   const ParseRule &rule = getRule(operatorType);
+  std::optional<ConstantExpr> lhs = trailingConstant();
   parsePrecedence(static_cast<Precedence>(rule.precedence + 1));
 
+  if (std::optional<ConstantExpr> rhs = trailingConstant();
+      lhs && rhs && rhs->start == lhs->end) {
+    if (std::optional<Value> folded =
+            foldBinary(operatorType, lhs->value, rhs->value)) {
+      discardConstant(*rhs);
+      discardConstant(*lhs);
+      emitFolded(*folded);
+      return;
+    }
+  }
+
   switch (operatorType) {
   case TOKEN_BANG_EQUAL:
-    emitBytes(OP_EQUAL, OP_NOT);
+    emitByte(OP_EQUAL, operatorToken);
+    emitByte(OP_NOT, operatorToken);
     break;
   case TOKEN_EQUAL_EQUAL:
-    emitByte(OP_EQUAL);
+    emitByte(OP_EQUAL, operatorToken);
     break;
   case TOKEN_GREATER:
-    emitByte(OP_GREATER);
+    emitByte(OP_GREATER, operatorToken);
     break;
   case TOKEN_GREATER_EQUAL:
-    emitBytes(OP_LESS, OP_NOT);
+    emitByte(OP_LESS, operatorToken);
+    emitByte(OP_NOT, operatorToken);
     break;
   case TOKEN_LESS:
-    emitByte(OP_LESS);
+    emitByte(OP_LESS, operatorToken);
     break;
   case TOKEN_LESS_EQUAL:
-    emitBytes(OP_GREATER, OP_NOT);
+    emitByte(OP_GREATER, operatorToken);
+    emitByte(OP_NOT, operatorToken);
     break;
   case TOKEN_PLUS:
-    emitByte(OP_ADD);
+    emitByte(OP_ADD, operatorToken);
     break;
   case TOKEN_MINUS:
-    emitByte(OP_SUBTRACT);
+    emitByte(OP_SUBTRACT, operatorToken);
     break;
   case TOKEN_STAR:
-    emitByte(OP_MULTIPLY);
+    emitByte(OP_MULTIPLY, operatorToken);
     break;
   case TOKEN_SLASH:
-    emitByte(OP_DIVIDE);
+    emitByte(OP_DIVIDE, operatorToken);
     break;
   default:
     std::unreachable();
@@ -132,13 +206,13 @@ void Emitter::binary(bool /*canAssign*/) {
 void Emitter::literal(bool /*canAssign*/) {
   switch (parser.previous.type) {
   case TOKEN_FALSE:
-    emitByte(OP_FALSE);
+    emitLiteral(OP_FALSE, Value::Bool(false));
     break;
   case TOKEN_NIL:
-    emitByte(OP_NIL);
+    emitLiteral(OP_NIL, Value::Nil());
     break;
   case TOKEN_TRUE:
-    emitByte(OP_TRUE);
+    emitLiteral(OP_TRUE, Value::Bool(true));
     break;
   default:
     std::unreachable();
@@ -165,21 +239,28 @@ void Emitter::string(bool /*canAssign*/) {
 void Emitter::namedVariable(Token name, bool canAssign) {
   uint8_t getOp = 0;
   uint8_t setOp = 0;
-  int arg = resolveLocal(name);
-  if (arg != -1) {
+  uint8_t getLongOp = 0;
+  uint8_t setLongOp = 0;
+  size_t arg = 0;
+  if (int local = resolveLocal(name); local != -1) {
+    arg = static_cast<size_t>(local);
     getOp = OP_GET_LOCAL;
     setOp = OP_SET_LOCAL;
+    getLongOp = OP_GET_LOCAL_LONG;
+    setLongOp = OP_SET_LOCAL_LONG;
   } else {
-    arg = identifierConstant(name);
+    arg = globalSlot(name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
+    getLongOp = OP_GET_GLOBAL_LONG;
+    setLongOp = OP_SET_GLOBAL_LONG;
   }
 
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitBytes(setOp, static_cast<uint8_t>(arg));
+    emitOperand(setOp, setLongOp, arg, name);
   } else {
-    emitBytes(getOp, static_cast<uint8_t>(arg));
+    emitOperand(getOp, getLongOp, arg);
   }
 }
 
@@ -188,18 +269,27 @@ void Emitter::variable(bool canAssign) {
 }
 
 void Emitter::unary(bool /*canAssign*/) {
-  TokenType operatorType = parser.previous.type;
+  Token operatorToken = parser.previous;
+  TokenType operatorType = operatorToken.type;
 
   // Compile the operand
   parsePrecedence(PREC_UNARY);
 
+  if (std::optional<ConstantExpr> operand = trailingConstant()) {
+    if (std::optional<Value> folded = foldUnary(operatorType, operand->value)) {
+      discardConstant(*operand);
+      emitFolded(*folded);
+      return;
+    }
+  }
+
   // Emit the operator instruction.
   switch (operatorType) {
   case TOKEN_BANG:
-    emitByte(OP_NOT);
+    emitByte(OP_NOT, operatorToken);
     break;
   case TOKEN_MINUS:
-    emitByte(OP_NEGATE);
+    emitByte(OP_NEGATE, operatorToken);
     break;
   default:
     std::unreachable();
@@ -228,49 +318,53 @@ void Emitter::parsePrecedence(Precedence precedence) {
   }
 }
 
-uint8_t Emitter::identifierConstant(Token &name) {
-  return makeConstant(Value::Object(vm.copyString(name.str)));
-}
+size_t Emitter::globalSlot(Token &name) {
+  size_t slot = vm.globalSlot(vm.copyString(name.str));
+  if (slot >= UINT24_COUNT) {
+    error("Too many global variables.");
+    return 0;
+  }
 
-static bool identifiersEqual(Token &a, Token &b) { return a.str == b.str; }
+  return slot;
+}
 
 int Emitter::resolveLocal(Token &name) {
-  for (int i = compiler.localCount - 1; i >= 0; i--) {
-    Local &local = compiler.locals[i];
-    if (identifiersEqual(name, local.name)) {
-      if (local.depth == -1) {
-        error("Can't read local variable in its own initializer.");
-      }
-      return i;
-    }
-  }
+  auto it = compiler.innermost.find(name.str);
+  if (it == compiler.innermost.end())
+    return -1;
 
-  return -1;
+  if (compiler.locals[it->second].depth == -1) {
+    error("Can't read local variable in its own initializer.");
+  }
+  return it->second;
 }
 
 void Emitter::addLocal(Token name) {
-  if (compiler.localCount == UINT8_COUNT) {
+  if (compiler.locals.size() == LOCALS_MAX) {
     error("Too many local variables in function.");
     return;
   }
 
-  Local &local = compiler.locals[compiler.localCount++];
-  local.name = name;
-  local.depth = -1;
+  auto index = static_cast<int>(compiler.locals.size());
+  auto [it, inserted] = compiler.innermost.try_emplace(name.str, index);
+  int shadowed = -1;
+  if (!inserted)
+    shadowed = std::exchange(it->second, index);
+  compiler.locals.push_back(
+      Local{.name = name, .depth = -1, .shadowed = shadowed});
 }
 
 void Emitter::declareVariable() {
   if (compiler.scopeDepth == 0)
     return;
 
+  // Locals are declared innermost scope last, so only the innermost one of
+  // this name can be in the same scope.
   Token &name = parser.previous;
-  for (int i = compiler.localCount - 1; i >= 0; i--) {
-    Local &local = compiler.locals[i];
-    if (local.depth != -1 && local.depth < compiler.scopeDepth) {
-      break;
-    }
-
-    if (identifiersEqual(name, local.name)) {
+  if (auto it = compiler.innermost.find(name.str);
+      it != compiler.innermost.end()) {
+    const Local &local = compiler.locals[it->second];
+    if (local.depth == -1 || local.depth >= compiler.scopeDepth) {
       error("Already a variable with this name in this scope.");
     }
   }
@@ -278,27 +372,27 @@ void Emitter::declareVariable() {
   addLocal(name);
 }
 
-uint8_t Emitter::parseVariable(std::string_view errorMessage) {
+size_t Emitter::parseVariable(std::string_view errorMessage) {
   consume(TOKEN_IDENTIFIER, errorMessage);
 
   declareVariable();
   if (compiler.scopeDepth > 0)
     return 0;
 
-  return identifierConstant(parser.previous);
+  return globalSlot(parser.previous);
 }
 
 void Emitter::markInitialized() {
-  compiler.locals[compiler.localCount - 1].depth = compiler.scopeDepth;
+  compiler.locals.back().depth = compiler.scopeDepth;
 }
 
-void Emitter::defineVariable(uint8_t global) {
+void Emitter::defineVariable(size_t global) {
   if (compiler.scopeDepth > 0) {
     markInitialized();
     return;
   }
 
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitOperand(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
 }
 
 }; // namespace clox
@@ -0,0 +1,168 @@
+#include "lexer.hpp"
+
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <thread>
+
+namespace clox {
+
+namespace {
+
+// A piece of the source starting at the beginning of a line. Its tokens are
+// lexed speculatively, assuming it does not start inside a string literal,
+// and their lines count from 1 at `begin`.
+struct Segment {
+  const char *begin;
+  const char *end;
+  std::vector<PackedToken> tokens;
+  int newlines = 0;
+};
+
+PackedToken pack(const Token &token, std::string_view lexeme,
+                 const char *source) {
+  PackedToken packed{};
+  packed.offset = static_cast<uint32_t>(lexeme.data() - source);
+  packed.length = static_cast<uint32_t>(lexeme.size());
+  packed.line = token.line;
+  // Columns past the field's range only happen on absurdly long lines.
+  packed.column = static_cast<uint32_t>(std::min(token.column, (1 << 24) - 1));
+  packed.type = token.type;
+  if (token.type == TOKEN_ERROR) {
+    packed.error = token.str == SCAN_ERROR_MESSAGES[SCAN_UNTERMINATED_STRING]
+                       ? SCAN_UNTERMINATED_STRING
+                       : SCAN_UNEXPECTED_CHARACTER;
+  }
+  return packed;
+}
+
+// Lexes the tokens that start inside the segment; the last one may run past
+// its end. Only the final segment includes TOKEN_EOF.
+void lexSegment(const char *source, Segment &segment, bool last) {
+  Scanner scanner(segment.begin, 1, segment.begin);
+  for (;;) {
+    Token token = scanner.scanToken();
+    std::string_view lexeme = scanner.lexeme();
+    if (!last && lexeme.data() >= segment.end)
+      break;
+    segment.tokens.push_back(pack(token, lexeme, source));
+    if (token.type == TOKEN_EOF)
+      break;
+  }
+  segment.newlines =
+      static_cast<int>(std::count(segment.begin, segment.end, '\n'));
+}
+
+// Splits the source into up to `count` segments that each start at the
+// beginning of a line.
+std::vector<Segment> split(const char *source, size_t length, unsigned count) {
+  std::vector<Segment> segments;
+  const char *end = source + length;
+  const char *begin = source;
+  for (unsigned i = 1; i < count && begin < end; i++) {
+    const char *target = source + length / count * i;
+    if (target <= begin)
+      continue;
+    const auto *newline = static_cast<const char *>(
+        std::memchr(target, '\n', static_cast<size_t>(end - target)));
+    if (newline == nullptr)
+      break;
+    segments.push_back({.begin = begin, .end = newline + 1, .tokens = {}});
+    begin = newline + 1;
+  }
+  segments.push_back({.begin = begin, .end = end, .tokens = {}});
+  return segments;
+}
+
+} // namespace
+
+std::vector<PackedToken> lexParallel(const char *source, size_t length,
+                                     unsigned threads) {
+  std::vector<Segment> segments = split(source, length, threads);
+
+  {
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < segments.size(); i++) {
+      workers.emplace_back(lexSegment, source, std::ref(segments[i]),
+                           i + 1 == segments.size());
+    }
+    lexSegment(source, segments[0], segments.size() == 1);
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Stitch the segments together in order. A segment's speculation was right
+  // unless the token before it runs into it, which only a string literal
+  // spanning the boundary can do. Then lex sequentially from the end of that
+  // token until a token starts where a speculative one did: from there on
+  // the speculative tokens are the real ones, because the scanner carries no
+  // state between tokens besides the position.
+  std::vector<PackedToken> result;
+  int baseLine = 1;
+  for (size_t i = 0; i < segments.size(); i++) {
+    Segment &segment = segments[i];
+    bool last = i + 1 == segments.size();
+    size_t firstValid = 0;
+
+    if (!result.empty() && result.back().type == TOKEN_EOF)
+      break;
+
+    if (!result.empty() &&
+        source + result.back().offset + result.back().length > segment.begin) {
+      const PackedToken &previous = result.back();
+      const char *resume = source + previous.offset + previous.length;
+      std::string_view before(source, static_cast<size_t>(resume - source));
+      size_t newline = before.rfind('\n');
+      const char *lineStart =
+          newline == std::string_view::npos ? source : source + newline + 1;
+
+      // A token's line is the scanner's line right after it.
+      Scanner scanner(resume, previous.line, lineStart);
+      firstValid = segment.tokens.size();
+      size_t candidate = 0;
+      for (;;) {
+        Token token = scanner.scanToken();
+        std::string_view lexeme = scanner.lexeme();
+        if (!last && lexeme.data() >= segment.end)
+          break;
+
+        auto offset = static_cast<uint32_t>(lexeme.data() - source);
+        while (candidate < segment.tokens.size() &&
+               segment.tokens[candidate].offset < offset)
+          candidate++;
+        if (candidate < segment.tokens.size() &&
+            segment.tokens[candidate].offset == offset) {
+          firstValid = candidate;
+          break;
+        }
+
+        result.push_back(pack(token, lexeme, source));
+        if (token.type == TOKEN_EOF)
+          break;
+      }
+    }
+
+    for (size_t j = firstValid; j < segment.tokens.size(); j++) {
+      PackedToken token = segment.tokens[j];
+      token.line += baseLine - 1;
+      result.push_back(token);
+    }
+    baseLine += segment.newlines;
+  }
+
+  return result;
+}
+
+TokenStream::TokenStream(const char *source)
+    : source(source), scanner(source) {
+  size_t length = std::strlen(source);
+  if (length < PARALLEL_MIN_SIZE || length > UINT32_MAX)
+    return;
+
+  unsigned threads = std::min<size_t>(std::thread::hardware_concurrency(),
+                                      length / SEGMENT_MIN_SIZE);
+  if (threads > 1)
+    tokens = lexParallel(source, length, threads);
+}
+} // namespace clox
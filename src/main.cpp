@@ -1,14 +1,23 @@
+#include <charconv>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <print>
-#include <sstream>
 #include <string>
+#include <string_view>
 
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+#include "serializer.hpp"
 #include "vm.hpp"
 
 namespace fs = std::filesystem;
 
+// Fallback for files that cannot be mapped, such as pipes.
 static std::string readFile(const fs::path &path) {
   std::ifstream file(path, std::ios::in | std::ios::binary);
   if (!file.is_open()) {
@@ -16,21 +25,117 @@ static std::string readFile(const fs::path &path) {
     std::exit(74);
   }
 
-  std::ostringstream buffer;
-  buffer << file.rdbuf();
-  if (!file) {
+  std::string contents{std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>()};
+  if (file.bad()) {
     std::println(std::cerr, "Could not read file \"{}\".", path.string());
     std::exit(74);
   }
 
-  return buffer.str();
+  return contents;
+}
+
+// A script's text, NUL-terminated for the Scanner. Regular files are mapped,
+// so tokens point straight into the page cache and the source is never
+// copied.
+class Source {
+  std::optional<clox::MappedFile> mapped;
+  std::string contents;
+
+public:
+  explicit Source(const fs::path &path)
+      : mapped(clox::MappedFile::mapText(path)) {
+    if (!mapped)
+      contents = readFile(path);
+  }
+
+  [[nodiscard]] std::string_view text() const {
+    return mapped ? mapped->text() : std::string_view(contents);
+  }
+
+  [[nodiscard]] const char *c_str() const { return text().data(); }
+};
+
+// Writes through a temporary file so a concurrent reader never sees a partial
+// one.
+static bool writeFile(const fs::path &path, std::string_view data) {
+  fs::path temporary = path;
+  temporary += std::format(".{}.tmp", ::getpid());
+  {
+    std::ofstream file(temporary, std::ios::out | std::ios::binary);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file) {
+      std::error_code ignored;
+      fs::remove(temporary, ignored);
+      return false;
+    }
+  }
+
+  std::error_code error;
+  fs::rename(temporary, path, error);
+  return !error;
+}
+
+static void exitOnError(clox::InterpretResult result) {
+  if (result == clox::INTERPRET_COMPILE_ERROR)
+    std::exit(65);
+  if (result == clox::INTERPRET_RUNTIME_ERROR)
+    std::exit(70);
 }
 
 // TODO: Put this in separate file?
 class Driver {
+  std::optional<clox::Profiler> profiler;
+  std::optional<clox::Sampler> sampler;
+  fs::path sampleOutput;
   clox::VM vm;
+  bool optimize = true;
+  bool cache = false;
+  bool memoryStats = false;
+
+  // Reports the profile and memory use and writes the samples, if any of
+  // them were asked for, and exits if `result` is an error.
+  void finish(clox::InterpretResult result) {
+    if (profiler)
+      profiler->report();
+    if (memoryStats)
+      vm.memoryStats().report();
+    if (sampler && !writeFile(sampleOutput, sampler->collapsed())) {
+      std::println(std::cerr, "Could not write file \"{}\".",
+                   sampleOutput.string());
+      std::exit(74);
+    }
+    exitOnError(result);
+  }
 
 public:
+  void setOptimize(bool enabled) {
+    optimize = enabled;
+    vm.setOptimize(enabled);
+  }
+
+  // Whether runFile keeps compiled scripts in a .loxc file next to the
+  // source. Unoptimized runs always compile from source.
+  void setCache(bool enabled) { cache = enabled; }
+
+  // Profiles everything the VM runs and reports it when the run is over.
+  void setProfile() {
+    profiler.emplace();
+    vm.setProfiler(&*profiler);
+  }
+
+  // Samples everything the VM runs `rate` times a second and writes the
+  // collapsed stacks to `output` when the run is over.
+  void setSample(const fs::path &output, int rate) {
+    sampler.emplace(rate);
+    sampleOutput = output;
+    vm.setSampler(&*sampler);
+  }
+
+  // Reports what the VM allocated, by category and size, when the run is
+  // over.
+  void setMemoryStats(bool enabled) { memoryStats = enabled; }
+
   void repl() {
     std::string line;
     for (;;) {
@@ -43,29 +148,141 @@ public:
 
       vm.interpret(line.c_str());
     }
+    finish(clox::INTERPRET_OK);
   }
 
   void runFile(const fs::path &path) {
-    std::string source = readFile(path);
-    clox::InterpretResult result = vm.interpret(source.c_str());
+    if (path.extension() == ".loxc") {
+      runBytecode(path);
+      return;
+    }
+
+    Source source(path);
+    if (!cache || !optimize) {
+      finish(vm.interpret(source.c_str()));
+      return;
+    }
+
+    // The cache is stale if the source changed or it was written by another
+    // version of the VM; loadScript checks both.
+    uint64_t hash = clox::hashSource(source.text());
+    fs::path cachePath = fs::path(path).replace_extension(".loxc");
+    std::shared_ptr<const clox::Script> script;
+    if (std::optional<clox::MappedFile> cached =
+            clox::MappedFile::map(cachePath))
+      script = clox::loadScript(cached->bytes(), hash);
+    if (!script) {
+      script = vm.compileScript(source.c_str());
+      if (!script)
+        std::exit(65);
+      // Failing to write the cache only costs the next run a compile.
+      writeFile(cachePath, clox::serializeScript(*script, hash));
+    }
+    finish(vm.execute(script));
+  }
+
+  void runBytecode(const fs::path &path) {
+    std::optional<clox::MappedFile> file = clox::MappedFile::map(path);
+    if (!file) {
+      std::println(std::cerr, "Could not open file \"{}\".", path.string());
+      std::exit(74);
+    }
+    std::shared_ptr<const clox::Script> script =
+        clox::loadScript(file->bytes(), std::nullopt);
+    if (!script) {
+      std::println(std::cerr, "Invalid or outdated bytecode file \"{}\".",
+                   path.string());
+      std::exit(65);
+    }
+    finish(vm.execute(script));
+  }
 
-    if (result == clox::INTERPRET_COMPILE_ERROR)
+  void compileFile(const fs::path &path, const fs::path &output) {
+    Source source(path);
+    std::shared_ptr<const clox::Script> script =
+        vm.compileScript(source.c_str());
+    if (!script)
       std::exit(65);
-    if (result == clox::INTERPRET_RUNTIME_ERROR)
-      std::exit(70);
+
+    if (!writeFile(output, clox::serializeScript(
+                               *script, clox::hashSource(source.text())))) {
+      std::println(std::cerr, "Could not write file \"{}\".", output.string());
+      std::exit(74);
+    }
   }
 };
 
+[[noreturn]] static void usage() {
+  std::println(std::cerr,
+               "Usage: clox [--no-peephole] [--cache] [--mem-stats] "
+               "[--profile | --sample output [--sample-rate hz]] [path]");
+  std::println(std::cerr,
+               "       clox [--no-peephole] --compile path [-o output]");
+  std::exit(64);
+}
+
 int main(int argc, char *argv[]) {
   Driver driver;
+  std::optional<fs::path> path;
+  std::optional<fs::path> output;
+  std::optional<fs::path> sampleOutput;
+  std::optional<int> sampleRate;
+  bool profile = false;
+  bool compile = false;
 
-  if (argc == 1) {
-    driver.repl();
-  } else if (argc == 2) {
-    driver.runFile(argv[1]);
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (arg == "--no-peephole") {
+      driver.setOptimize(false);
+    } else if (arg == "--cache") {
+      driver.setCache(true);
+    } else if (arg == "--profile") {
+      profile = true;
+    } else if (arg == "--mem-stats") {
+      driver.setMemoryStats(true);
+    } else if (arg == "--sample" && i + 1 < argc && !sampleOutput) {
+      sampleOutput = argv[++i];
+    } else if (arg == "--sample-rate" && i + 1 < argc && !sampleRate) {
+      std::string_view value = argv[++i];
+      int rate = 0;
+      auto [end, error] =
+          std::from_chars(value.data(), value.data() + value.size(), rate);
+      if (error != std::errc() || end != value.data() + value.size() ||
+          rate <= 0)
+        usage();
+      sampleRate = rate;
+    } else if (arg == "--compile") {
+      compile = true;
+    } else if (arg == "-o" && i + 1 < argc && !output) {
+      output = argv[++i];
+    } else if (!arg.starts_with("-") && !path) {
+      path = arg;
+    } else {
+      usage();
+    }
+  }
+
+  // The VM runs under one instrument at a time.
+  if ((sampleRate && !sampleOutput) || (profile && sampleOutput))
+    usage();
+  if (profile)
+    driver.setProfile();
+  if (sampleOutput)
+    driver.setSample(*sampleOutput,
+                     sampleRate.value_or(clox::Sampler::DEFAULT_RATE));
+
+  if (compile) {
+    if (!path)
+      usage();
+    driver.compileFile(*path,
+                       output.value_or(fs::path(*path).replace_extension(
+                           ".loxc")));
+  } else if (output) {
+    usage();
+  } else if (path) {
+    driver.runFile(*path);
   } else {
-    std::println(std::cerr, "Usage: clox [path]");
-    std::exit(64);
+    driver.repl();
   }
 
   return 0;
@@ -0,0 +1,93 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clox {
+
+namespace {
+
+// Opens `path` and returns the descriptor and the file's size, or -1.
+int openForMapping(const std::filesystem::path &path, size_t &size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct stat info {};
+  if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    ::close(fd);
+    return -1;
+  }
+
+  size = static_cast<size_t>(info.st_size);
+  return fd;
+}
+
+void adviseSequential(void *data, size_t size, size_t threshold) {
+  if (size >= threshold)
+    ::madvise(data, size, MADV_SEQUENTIAL);
+}
+
+} // namespace
+
+std::optional<MappedFile> MappedFile::map(const std::filesystem::path &path) {
+  size_t size = 0;
+  int fd = openForMapping(path, size);
+  if (fd < 0)
+    return std::nullopt;
+
+  // mmap rejects empty mappings, and an empty file needs no memory anyway.
+  if (size == 0) {
+    ::close(fd);
+    return MappedFile(nullptr, 0, 0);
+  }
+
+  void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file.
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return std::nullopt;
+
+  adviseSequential(data, size, SEQUENTIAL_MIN_SIZE);
+  return MappedFile(static_cast<std::byte *>(data), size, size);
+}
+
+std::optional<MappedFile>
+MappedFile::mapText(const std::filesystem::path &path) {
+  size_t size = 0;
+  int fd = openForMapping(path, size);
+  if (fd < 0)
+    return std::nullopt;
+
+  // Reserve the file's pages plus one more of anonymous zeroes, then map the
+  // file over the front. The kernel zero-fills the tail of the file's last
+  // page, and if the file ends exactly on a page boundary the extra page
+  // supplies the NUL, so no byte of the file is ever copied.
+  auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t mappingSize = (size + page - 1) / page * page + page;
+  void *data = ::mmap(nullptr, mappingSize, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    ::close(fd);
+    return std::nullopt;
+  }
+
+  if (size > 0 && ::mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd,
+                         0) == MAP_FAILED) {
+    ::close(fd);
+    ::munmap(data, mappingSize);
+    return std::nullopt;
+  }
+  ::close(fd);
+
+  adviseSequential(data, size, SEQUENTIAL_MIN_SIZE);
+  return MappedFile(static_cast<std::byte *>(data), size, mappingSize);
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr)
+    ::munmap(data, mappingSize);
+}
+} // namespace clox
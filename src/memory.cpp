@@ -0,0 +1,290 @@
+#include "memory.hpp"
+#include "common.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clox {
+
+void *GCResource::allocate(MemoryCategory category, std::size_t bytes,
+                          std::size_t alignment) {
+  stats.total.allocated(bytes);
+  stats.categories[category].allocated(bytes);
+  if (enabled) {
+#ifdef DEBUG_STRESS_GC
+    vm.collectGarbage();
+#else
+    if (stats.total.liveBytes > nextGC)
+      vm.collectGarbage();
+#endif
+  }
+
+  return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void GCResource::deallocate(MemoryCategory category, void *p,
+                            std::size_t bytes, std::size_t alignment) {
+  stats.total.deallocated(bytes);
+  stats.categories[category].deallocated(bytes);
+  std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+void MemoryStats::report() const {
+  std::println(std::cerr, "== memory: {} bytes live, {} peak ==",
+               total.liveBytes, total.peakBytes);
+  std::println(std::cerr, "{:<10} {:>12} {:>12} {:>14} {:>12} {:>12}",
+               "category", "live", "peak", "allocated", "allocs", "frees");
+  auto row = [](std::string_view name, const AllocationStats &stats) {
+    std::println(std::cerr, "{:<10} {:>12} {:>12} {:>14} {:>12} {:>12}", name,
+                 stats.liveBytes, stats.peakBytes, stats.totalBytes,
+                 stats.allocations, stats.deallocations);
+  };
+  for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    row(MEMORY_CATEGORY_NAMES[i], categories[i]);
+  }
+  row("total", total);
+
+  // Columns only for the categories that allocated anything.
+  std::vector<size_t> columns;
+  for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    if (categories[i].allocations != 0)
+      columns.push_back(i);
+  }
+
+  std::string header = std::format("{:<10}", "size");
+  for (size_t i : columns) {
+    header += std::format(" {:>10}", MEMORY_CATEGORY_NAMES[i]);
+  }
+  std::println(std::cerr, "{}", header);
+  for (size_t bucket = 0; bucket < AllocationStats::SIZE_BUCKETS; bucket++) {
+    if (total.sizes[bucket] == 0)
+      continue;
+    std::string line =
+        bucket + 1 == AllocationStats::SIZE_BUCKETS
+            ? std::format("> {:<8}", size_t{1} << (bucket - 1))
+            : std::format("<= {:<7}", size_t{1} << bucket);
+    for (size_t i : columns) {
+      line += std::format(" {:>10}", categories[i].sizes[bucket]);
+    }
+    std::println(std::cerr, "{}", line);
+  }
+}
+
+void VM::freeObject(Obj *obj) {
+#ifdef DEBUG_LOG_GC
+  std::println("{} free type {}", static_cast<void *>(obj),
+               static_cast<int>(obj->getType()));
+#endif
+
+  switch (obj->getType()) {
+  case OBJ_STRING:
+    ObjString::destroy(allocatorFor(MEMORY_STRING),
+                       static_cast<ObjString *>(obj));
+    break;
+  case OBJ_ROPE:
+    allocatorFor(MEMORY_ROPE).delete_object(static_cast<ObjRope *>(obj));
+    break;
+  }
+}
+
+void VM::markObject(Obj *obj) {
+  if (obj == nullptr || obj->isMarked())
+    return;
+
+#ifdef DEBUG_LOG_GC
+  std::println("{} mark {}", static_cast<void *>(obj), Value::Object(obj));
+#endif
+
+  obj->setMarked(true);
+  grayStack.push_back(obj);
+#ifdef GENERATIONAL_GC
+  // Young objects are traced through but never swept here, so their marks
+  // have to be cleared by hand once the collection is over.
+  if (nursery.contains(obj))
+    markedYoung.push_back(obj);
+#endif
+}
+
+void VM::markValue(Value value) {
+  if (value.isObj())
+    markObject(value.asObj());
+}
+
+void VM::markRoots() {
+  for (Value *slot = stack.data(); slot < stackTop; slot++) {
+    markValue(*slot);
+  }
+
+  // The names double as the keys of `globalSlots`, which the compiler still
+  // needs for as long as the VM lives.
+  for (ObjString *name : globalNames) {
+    markObject(name);
+  }
+  for (const Global &global : globals) {
+    markValue(global.value);
+  }
+
+  for (size_t i = 0; i < chunk.constantCount(); i++) {
+    markValue(chunk.getConstant(i));
+  }
+}
+
+void VM::blackenObject(Obj *obj) {
+#ifdef DEBUG_LOG_GC
+  std::println("{} blacken {}", static_cast<void *>(obj), Value::Object(obj));
+#endif
+
+  switch (obj->getType()) {
+  case OBJ_STRING:
+    // Strings hold no references.
+    break;
+  case OBJ_ROPE: {
+    auto *rope = static_cast<ObjRope *>(obj);
+    markObject(rope->getLeft());
+    markObject(rope->getRight());
+    markObject(rope->getFlat());
+    break;
+  }
+  }
+}
+
+void VM::traceReferences() {
+  while (!grayStack.empty()) {
+    Obj *obj = grayStack.back();
+    grayStack.pop_back();
+    blackenObject(obj);
+  }
+}
+
+void VM::sweep() {
+  std::erase_if(objects, [this](Obj *obj) {
+    if (obj->isMarked()) {
+      obj->setMarked(false);
+      return false;
+    }
+    freeObject(obj);
+    return true;
+  });
+}
+
+void VM::collectGarbage() {
+#ifdef DEBUG_LOG_GC
+  std::println("-- gc begin");
+  size_t before = resource.getBytesAllocated();
+#endif
+
+  markRoots();
+  traceReferences();
+  strings.removeWhite();
+  sweep();
+#ifdef GENERATIONAL_GC
+  for (Obj *obj : markedYoung) {
+    obj->setMarked(false);
+  }
+  markedYoung.clear();
+#endif
+
+  resource.updateThreshold();
+
+#ifdef DEBUG_LOG_GC
+  std::println("-- gc end");
+  std::println("   collected {} bytes (from {} to {}) next at {}",
+               before - resource.getBytesAllocated(), before,
+               resource.getBytesAllocated(), resource.getNextGC());
+#endif
+}
+#ifdef GENERATIONAL_GC
+// Copies every nursery object that is still reachable into the main heap and
+// resets the nursery. Young objects can only be referenced from the stack,
+// from globals in the remembered set, from other young objects, and (weakly)
+// from the string table. Chunk constants, global names and flattened rope
+// contents all come from copyString(), which never returns a young string.
+void VM::minorCollect() {
+#ifdef DEBUG_LOG_GC
+  std::println("-- minor gc begin");
+#endif
+
+  // Promotion allocates from the main heap; a major collection in the middle
+  // of moving objects would see half-updated roots.
+  resource.disable();
+
+  // Promoted ropes still point at their young children until the worklist
+  // below gets to them.
+  std::vector<ObjRope *> promotedRopes;
+
+  auto promote = [this, &promotedRopes](Obj *obj) -> Obj * {
+    if (obj == nullptr || !nursery.contains(obj))
+      return obj;
+    if (auto it = forwarding.find(obj); it != forwarding.end())
+      return it->second;
+
+    Obj *old = nullptr;
+    switch (obj->getType()) {
+    case OBJ_STRING: {
+      auto *young = static_cast<ObjString *>(obj);
+      old = ObjString::create(allocatorFor(MEMORY_STRING), young->getString(),
+                              young->getHash());
+      break;
+    }
+    case OBJ_ROPE: {
+      auto *young = static_cast<ObjRope *>(obj);
+      auto *rope = allocatorFor(MEMORY_ROPE).new_object<ObjRope>(*young);
+      promotedRopes.push_back(rope);
+      old = rope;
+      break;
+    }
+    }
+
+    objects.push_back(old);
+    forwarding.emplace(obj, old);
+#ifdef DEBUG_LOG_GC
+    std::println("{} promote to {}", static_cast<void *>(obj),
+                 static_cast<void *>(old));
+#endif
+    return old;
+  };
+
+  for (Value *slot = stack.data(); slot < stackTop; slot++) {
+    if (slot->isObj())
+      *slot = Value::Object(promote(slot->asObj()));
+  }
+
+  for (size_t index : rememberedGlobals) {
+    Global &global = globals[index];
+    if (global.value.isObj())
+      global.value = Value::Object(promote(global.value.asObj()));
+    global.remembered = false;
+  }
+  rememberedGlobals.clear();
+
+  while (!promotedRopes.empty()) {
+    ObjRope *rope = promotedRopes.back();
+    promotedRopes.pop_back();
+    rope->setChildren(promote(rope->getLeft()), promote(rope->getRight()));
+  }
+
+  strings.rekey([this](ObjString *key) -> ObjString * {
+    if (!nursery.contains(key))
+      return key;
+    auto it = forwarding.find(key);
+    return it != forwarding.end() ? static_cast<ObjString *>(it->second)
+                                  : nullptr;
+  });
+
+#ifdef DEBUG_LOG_GC
+  std::println("-- minor gc end");
+  std::println("   promoted {} objects", forwarding.size());
+#endif
+
+  forwarding.clear();
+  nursery.reset();
+  resource.enable();
+}
+#endif
+} // namespace clox
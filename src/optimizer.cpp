@@ -0,0 +1,91 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+
+namespace clox {
+
+void Peephole::run() {
+  output.clear();
+  output.reserve(chunk.size());
+
+  for (size_t offset = 0; offset < chunk.size();) {
+    Instruction instruction{.op = chunk.getCode(offset),
+                            .operands = {},
+                            .location = chunk.getLocation(offset)};
+    size_t size = instructionSize(instruction.op);
+    for (size_t i = 1; i < size; i++) {
+      instruction.operands[i - 1] = chunk.getCode(offset + i);
+    }
+    offset += size;
+
+    // Fusing can expose another pattern ending at the new instruction, so
+    // keep going until the tail is stable.
+    output.push_back(instruction);
+    while (fuseTail()) {
+    }
+  }
+
+  std::pmr::vector<uint8_t> code(chunk.get_allocator());
+  LineTable lines(chunk.get_allocator());
+  for (const Instruction &instruction : output) {
+    size_t size = instructionSize(instruction.op);
+    code.push_back(instruction.op);
+    code.insert(code.end(), instruction.operands.begin(),
+                instruction.operands.begin() + (size - 1));
+    for (size_t i = 0; i < size; i++) {
+      lines.add(instruction.location);
+    }
+  }
+  chunk.replaceCode(std::move(code), std::move(lines));
+}
+
+bool Peephole::tailIs(std::initializer_list<uint8_t> ops) const {
+  if (output.size() < ops.size())
+    return false;
+  return std::equal(ops.begin(), ops.end(), output.end() - ops.size(),
+                    [](uint8_t op, const Instruction &instruction) {
+                      return op == instruction.op;
+                    });
+}
+
+// Each fused instruction keeps the location of the instruction in the pattern
+// that can raise a runtime error, so error locations do not move.
+bool Peephole::fuseTail() {
+  if (tailIs({OP_EQUAL, OP_NOT}) || tailIs({OP_LESS, OP_NOT}) ||
+      tailIs({OP_GREATER, OP_NOT})) {
+    uint8_t op = back(1).op;
+    output.pop_back();
+    back(0).op = op == OP_EQUAL  ? OP_NOT_EQUAL
+                 : op == OP_LESS ? OP_GREATER_EQUAL
+                                 : OP_LESS_EQUAL;
+    return true;
+  }
+
+  if (tailIs({OP_CONSTANT, OP_ADD})) {
+    SourceLocation location = back(0).location;
+    output.pop_back();
+    back(0).op = OP_ADD_CONST;
+    back(0).location = location;
+    return true;
+  }
+
+  if (tailIs({OP_SET_LOCAL, OP_POP}) || tailIs({OP_SET_GLOBAL, OP_POP})) {
+    output.pop_back();
+    back(0).op = back(0).op == OP_SET_LOCAL ? OP_SET_LOCAL_POP
+                                            : OP_SET_GLOBAL_POP;
+    return true;
+  }
+
+  if (tailIs({OP_GET_LOCAL, OP_ADD_CONST, OP_SET_LOCAL_POP}) &&
+      back(2).operands[0] == back(0).operands[0]) {
+    Instruction fused{.op = OP_LOCAL_ADD_CONST,
+                      .operands = {back(2).operands[0], back(1).operands[0]},
+                      .location = back(1).location};
+    output.resize(output.size() - 3);
+    output.push_back(fused);
+    return true;
+  }
+
+  return false;
+}
+} // namespace clox
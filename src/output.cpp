@@ -0,0 +1,52 @@
+#include "output.hpp"
+
+#include <cerrno>
+#include <cstdio>
+
+#include <unistd.h>
+
+namespace clox {
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+    : fd(fd), buffer(std::make_unique_for_overwrite<char[]>(capacity)),
+      capacity(capacity), lineBuffered(::isatty(fd) != 0) {}
+
+void OutputBuffer::resize(size_t newCapacity) {
+  flush();
+  buffer = std::make_unique_for_overwrite<char[]>(newCapacity);
+  capacity = newCapacity;
+}
+
+void OutputBuffer::overflow(std::string_view bytes) {
+  flush();
+  if (bytes.size() >= capacity) {
+    writeAll(bytes);
+    return;
+  }
+  std::memcpy(buffer.get(), bytes.data(), bytes.size());
+  used = bytes.size();
+}
+
+void OutputBuffer::flush() {
+  if (used == 0)
+    return;
+  writeAll({buffer.get(), used});
+  used = 0;
+}
+
+void OutputBuffer::writeAll(std::string_view bytes) {
+  if (fd == STDOUT_FILENO)
+    std::fflush(stdout);
+
+  // Output that cannot be written is dropped, as stdio would.
+  while (!bytes.empty()) {
+    ssize_t written = ::write(fd, bytes.data(), bytes.size());
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    bytes.remove_prefix(static_cast<size_t>(written));
+  }
+}
+} // namespace clox
@@ -0,0 +1,68 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <print>
+#include <utility>
+
+namespace clox {
+
+void Profiler::finish(const Chunk &chunk) {
+  if (current != NO_OPCODE)
+    ticks[current] += now() - currentStart;
+  current = NO_OPCODE;
+
+  for (size_t offset = 0; offset < offsetCounts.size(); offset++) {
+    if (offsetCounts[offset] != 0)
+      lineCounts[chunk.getLine(offset)] += offsetCounts[offset];
+  }
+  offsetCounts.clear();
+}
+
+void Profiler::report() const {
+  uint64_t totalCount = 0;
+  uint64_t totalTicks = 0;
+  std::vector<uint8_t> opcodes;
+  for (size_t op = 0; op < OPCODE_COUNT; op++) {
+    totalCount += counts[op];
+    totalTicks += ticks[op];
+    if (counts[op] != 0)
+      opcodes.push_back(static_cast<uint8_t>(op));
+  }
+  std::ranges::sort(opcodes, [this](uint8_t a, uint8_t b) {
+    return ticks[a] != ticks[b] ? ticks[a] > ticks[b] : counts[a] > counts[b];
+  });
+
+  auto percent = [](uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0.0
+                      : 100.0 * static_cast<double>(part) /
+                            static_cast<double>(whole);
+  };
+
+  std::println(std::cerr, "== profile: {} instructions, {} {} ==", totalCount,
+               totalTicks, TICK_UNIT);
+  std::println(std::cerr, "{:<22} {:>12} {:>14} {:>7} {:>10}", "opcode",
+               "count", TICK_UNIT, "%", "per op");
+  for (uint8_t op : opcodes) {
+    std::println(std::cerr, "{:<22} {:>12} {:>14} {:>6.2f}% {:>10.1f}",
+                 OPCODE_NAMES[op], counts[op], ticks[op],
+                 percent(ticks[op], totalTicks),
+                 static_cast<double>(ticks[op]) /
+                     static_cast<double>(counts[op]));
+  }
+
+  std::vector<std::pair<int, uint64_t>> lines(lineCounts.begin(),
+                                              lineCounts.end());
+  std::ranges::sort(lines, [](const auto &a, const auto &b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  if (lines.size() > REPORT_LINES)
+    lines.resize(REPORT_LINES);
+
+  std::println(std::cerr, "{:<22} {:>12} {:>7}", "line", "count", "%");
+  for (const auto &[line, count] : lines) {
+    std::println(std::cerr, "{:<22} {:>12} {:>6.2f}%", line, count,
+                 percent(count, totalCount));
+  }
+}
+} // namespace clox
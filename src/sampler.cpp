@@ -0,0 +1,55 @@
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <format>
+
+namespace clox {
+
+Sampler::Sampler(int rate)
+    : interval(std::chrono::nanoseconds(std::chrono::seconds(1)) /
+               std::max(rate, 1)),
+      thread([this](std::stop_token stop) { sample(stop); }) {}
+
+void Sampler::sample(std::stop_token stop) {
+  std::unique_lock lock(mutex);
+  auto next = std::chrono::steady_clock::now();
+  for (;;) {
+    next += interval;
+    // Only a stop request ends the wait early.
+    if (wakeup.wait_until(lock, stop, next, [] { return false; }) ||
+        stop.stop_requested())
+      return;
+
+    size_t offset = current.load(std::memory_order_relaxed);
+    if (offset < offsetSamples.size())
+      offsetSamples[offset]++;
+  }
+}
+
+void Sampler::start(const Chunk &chunk) {
+  std::scoped_lock lock(mutex);
+  offsetSamples.assign(chunk.size(), 0);
+}
+
+void Sampler::finish(const Chunk &chunk) {
+  std::scoped_lock lock(mutex);
+  current.store(IDLE, std::memory_order_relaxed);
+  for (size_t offset = 0; offset < offsetSamples.size(); offset++) {
+    if (offsetSamples[offset] == 0)
+      continue;
+    stacks[std::format("script;line {};{}", chunk.getLine(offset),
+                       OPCODE_NAMES[chunk.getCode(offset)])] +=
+        offsetSamples[offset];
+  }
+  offsetSamples.clear();
+}
+
+std::string Sampler::collapsed() {
+  std::scoped_lock lock(mutex);
+  std::string out;
+  for (const auto &[stack, count] : stacks) {
+    out += std::format("{} {}\n", stack, count);
+  }
+  return out;
+}
+} // namespace clox
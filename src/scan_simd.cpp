@@ -0,0 +1,251 @@
+#include "scan_simd.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(SIMD_SCAN) && defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_VECTORIZED
+#include <immintrin.h>
+#endif
+
+namespace clox {
+
+namespace {
+
+#ifdef SCAN_VECTORIZED
+// For one aligned block, bit i of `stop` is set if byte i ends the run, and
+// bit i of `newlines` if it is a '\n'.
+struct BlockMask {
+  uint32_t stop;
+  uint32_t newlines;
+};
+
+// SSE2 is part of x86-64, so this path needs no check.
+namespace sse2 {
+constexpr size_t WIDTH = 16;
+
+[[gnu::no_sanitize("address", "thread")]] inline __m128i
+load(const char *block) {
+  return _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+}
+
+inline uint32_t equal(__m128i v, char c) {
+  return static_cast<uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+}
+
+// Signed compares, so bytes >= 0x80 are never in an ASCII range.
+inline uint32_t inRange(__m128i v, char lo, char hi) {
+  __m128i above = _mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1)));
+  __m128i below = _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(hi + 1)), v);
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(above, below)));
+}
+
+[[gnu::no_sanitize("address", "thread")]] BlockMask blank(const char *block) {
+  __m128i v = load(block);
+  uint32_t newlines = equal(v, '\n');
+  uint32_t blanks =
+      equal(v, ' ') | equal(v, '\t') | equal(v, '\r') | newlines;
+  return {~blanks, newlines};
+}
+
+[[gnu::no_sanitize("address", "thread")]] BlockMask
+identifier(const char *block) {
+  __m128i v = load(block);
+  // Setting 0x20 folds 'A'-'Z' onto 'a'-'z' without folding anything else
+  // into that range.
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  uint32_t word =
+      inRange(lower, 'a', 'z') | inRange(v, '0', '9') | equal(v, '_');
+  return {~word, 0};
+}
+
+[[gnu::no_sanitize("address", "thread")]] BlockMask digits(const char *block) {
+  return {~inRange(load(block), '0', '9'), 0};
+}
+
+[[gnu::no_sanitize("address", "thread")]] BlockMask
+stringBody(const char *block) {
+  __m128i v = load(block);
+  return {equal(v, '"') | equal(v, '\0'), equal(v, '\n')};
+}
+
+[[gnu::no_sanitize("address", "thread")]] BlockMask lineEnd(const char *block) {
+  __m128i v = load(block);
+  return {equal(v, '\n') | equal(v, '\0'), 0};
+}
+} // namespace sse2
+
+namespace avx2 {
+constexpr size_t WIDTH = 32;
+
+[[gnu::target("avx2"), gnu::no_sanitize("address", "thread")]] inline __m256i
+load(const char *block) {
+  return _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+}
+
+[[gnu::target("avx2")]] inline uint32_t equal(__m256i v, char c) {
+  return static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))));
+}
+
+[[gnu::target("avx2")]] inline uint32_t inRange(__m256i v, char lo, char hi) {
+  __m256i above =
+      _mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1)));
+  __m256i below =
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v);
+  return static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_and_si256(above, below)));
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize("address", "thread")]] BlockMask
+blank(const char *block) {
+  __m256i v = load(block);
+  uint32_t newlines = equal(v, '\n');
+  uint32_t blanks =
+      equal(v, ' ') | equal(v, '\t') | equal(v, '\r') | newlines;
+  return {~blanks, newlines};
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize("address", "thread")]] BlockMask
+identifier(const char *block) {
+  __m256i v = load(block);
+  __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+  uint32_t word =
+      inRange(lower, 'a', 'z') | inRange(v, '0', '9') | equal(v, '_');
+  return {~word, 0};
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize("address", "thread")]] BlockMask
+digits(const char *block) {
+  return {~inRange(load(block), '0', '9'), 0};
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize("address", "thread")]] BlockMask
+stringBody(const char *block) {
+  __m256i v = load(block);
+  return {equal(v, '"') | equal(v, '\0'), equal(v, '\n')};
+}
+
+[[gnu::target("avx2"), gnu::no_sanitize("address", "thread")]] BlockMask
+lineEnd(const char *block) {
+  __m256i v = load(block);
+  return {equal(v, '\n') | equal(v, '\0'), 0};
+}
+} // namespace avx2
+
+const bool hasAvx2 = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}();
+
+// Walks aligned blocks from the one containing `p` until `Classify` reports a
+// stop byte at or after `p`. An aligned load never crosses a page boundary,
+// so the block holding the terminator is always readable in full.
+template <size_t Width, BlockMask (*Classify)(const char *)>
+const char *scanRun(const char *p, int *line, const char **lineStart) {
+  constexpr uint32_t ALL = Width == 32 ? ~uint32_t{0} : (1U << Width) - 1;
+
+  size_t offset = reinterpret_cast<uintptr_t>(p) % Width;
+  const char *block = p - offset;
+  uint32_t valid = (ALL << offset) & ALL;
+  for (;;) {
+    BlockMask mask = Classify(block);
+    uint32_t stop = mask.stop & valid;
+    uint32_t newlines = mask.newlines & valid;
+    if (stop != 0)
+      newlines &= (uint32_t{1} << std::countr_zero(stop)) - 1;
+
+    if (newlines != 0) {
+      *line += std::popcount(newlines);
+      *lineStart = block + (31 - std::countl_zero(newlines)) + 1;
+    }
+    if (stop != 0)
+      return block + std::countr_zero(stop);
+
+    block += Width;
+    valid = ALL;
+  }
+}
+
+#define SCAN_RUN(kernel, p, line, lineStart)                                   \
+  (hasAvx2 ? scanRun<avx2::WIDTH, avx2::kernel>(p, line, lineStart)           \
+           : scanRun<sse2::WIDTH, sse2::kernel>(p, line, lineStart))
+#else
+bool isAlpha(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+#endif
+
+} // namespace
+
+const char *skipBlank(const char *p, int &line, const char *&lineStart) {
+#ifdef SCAN_VECTORIZED
+  return SCAN_RUN(blank, p, &line, &lineStart);
+#else
+  for (;; p++) {
+    switch (*p) {
+    case ' ':
+    case '\r':
+    case '\t':
+      break;
+    case '\n':
+      line++;
+      lineStart = p + 1;
+      break;
+    default:
+      return p;
+    }
+  }
+#endif
+}
+
+const char *skipIdentifier(const char *p) {
+#ifdef SCAN_VECTORIZED
+  return SCAN_RUN(identifier, p, nullptr, nullptr);
+#else
+  while (isAlpha(*p) || isDigit(*p))
+    p++;
+  return p;
+#endif
+}
+
+const char *skipDigits(const char *p) {
+#ifdef SCAN_VECTORIZED
+  return SCAN_RUN(digits, p, nullptr, nullptr);
+#else
+  while (isDigit(*p))
+    p++;
+  return p;
+#endif
+}
+
+const char *skipStringBody(const char *p, int &line, const char *&lineStart) {
+#ifdef SCAN_VECTORIZED
+  return SCAN_RUN(stringBody, p, &line, &lineStart);
+#else
+  for (; *p != '"' && *p != '\0'; p++) {
+    if (*p == '\n') {
+      line++;
+      lineStart = p + 1;
+    }
+  }
+  return p;
+#endif
+}
+
+const char *skipToLineEnd(const char *p) {
+#ifdef SCAN_VECTORIZED
+  return SCAN_RUN(lineEnd, p, nullptr, nullptr);
+#else
+  while (*p != '\n' && *p != '\0')
+    p++;
+  return p;
+#endif
+}
+
+#undef SCAN_RUN
+} // namespace clox
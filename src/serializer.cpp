@@ -0,0 +1,353 @@
+#include "serializer.hpp"
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "chunk.hpp"
+
+// A .loxc file is, in host byte order:
+//
+//   "LOXC" u32 version u64 build u64 sourceHash
+//   u32 codeSize   u8 code[codeSize]
+//   u32 runsSize   u8 runs[runsSize]            (LineTable::runs())
+//   u32 constantCount, each: u8 tag, then
+//       CONSTANT_NUMBER: u64 bits of the double
+//       CONSTANT_STRING: u32 length, characters
+//   u32 globalCount, each: u32 length, characters of the global's name
+//
+// Global operands index the table of names, which a VM maps onto its own
+// slots when it links the Script. `build` fingerprints the instruction set
+// and value layout of the build that wrote the file.
+
+namespace clox {
+
+namespace {
+
+constexpr std::array<char, 4> LOXC_MAGIC = {'L', 'O', 'X', 'C'};
+
+// 64-bit FNV-1a.
+constexpr uint64_t fnv1a(std::string_view bytes,
+                         uint64_t hash = 14695981039346656037U) {
+  for (char c : bytes) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211U;
+  }
+  return hash;
+}
+
+// Covers what a file's bytecode means to the build that reads it, so adding,
+// removing or renumbering an instruction makes every file stale without a
+// LOXC_VERSION bump. The value representation and byte order go in too:
+// they do not change the format, but a file written by a differently
+// configured build is cheap to recompile and not worth trusting.
+constexpr uint64_t buildFingerprint() {
+  uint64_t hash = fnv1a("");
+  for (size_t op = 0; op < OPCODE_COUNT; op++) {
+    const char size = static_cast<char>(instructionSize(op));
+    hash = fnv1a(OPCODE_NAMES[op], hash);
+    hash = fnv1a({&size, 1}, hash);
+  }
+  const std::array<char, 2> layout = {
+      static_cast<char>(sizeof(Value)),
+      static_cast<char>(std::endian::native == std::endian::little)};
+  return fnv1a({layout.data(), layout.size()}, hash);
+}
+
+constexpr uint64_t BUILD_FINGERPRINT = buildFingerprint();
+
+enum ConstantTag : uint8_t { CONSTANT_NUMBER, CONSTANT_STRING };
+
+class Writer {
+  std::string &out;
+
+public:
+  explicit Writer(std::string &out) : out(out) {}
+
+  template <typename T>
+  void put(T value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  void putBytes(std::string_view bytes) {
+    put(static_cast<uint32_t>(bytes.size()));
+    out.append(bytes);
+  }
+};
+
+class Reader {
+  std::span<const std::byte> data;
+
+public:
+  explicit Reader(std::span<const std::byte> data) : data(data) {}
+
+  template <typename T>
+  bool get(T &value) {
+    if (data.size() < sizeof(T))
+      return false;
+    std::memcpy(&value, data.data(), sizeof(T));
+    data = data.subspan(sizeof(T));
+    return true;
+  }
+
+  // Reads a u32 length and returns that many bytes.
+  bool getBytes(std::span<const std::byte> &bytes) {
+    uint32_t size = 0;
+    if (!get(size) || data.size() < size)
+      return false;
+    bytes = data.first(size);
+    data = data.subspan(size);
+    return true;
+  }
+
+  [[nodiscard]] bool atEnd() const { return data.empty(); }
+};
+
+std::string_view asChars(std::span<const std::byte> bytes) {
+  return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+}
+
+// How many values an instruction takes off the top of the stack, and how many
+// it leaves there in their place.
+struct StackEffect {
+  size_t pops;
+  size_t pushes;
+};
+
+constexpr StackEffect stackEffect(OpCode op) {
+  switch (op) {
+  case OP_CONSTANT:
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_GET_LOCAL:
+  case OP_GET_GLOBAL:
+  case OP_CONSTANT_LONG:
+  case OP_GET_LOCAL_LONG:
+  case OP_GET_GLOBAL_LONG:
+    return {0, 1};
+  case OP_POP:
+  case OP_DEFINE_GLOBAL:
+  case OP_PRINT:
+  case OP_DEFINE_GLOBAL_LONG:
+  case OP_SET_LOCAL_POP:
+  case OP_SET_GLOBAL_POP:
+    return {1, 0};
+  case OP_SET_LOCAL:
+  case OP_SET_GLOBAL:
+  case OP_NOT:
+  case OP_NEGATE:
+  case OP_SET_LOCAL_LONG:
+  case OP_SET_GLOBAL_LONG:
+  case OP_ADD_CONST:
+    return {1, 1};
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NOT_EQUAL:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_ADD_NUM:
+  case OP_ADD_STR:
+  case OP_SUBTRACT_NUM:
+  case OP_MULTIPLY_NUM:
+  case OP_DIVIDE_NUM:
+  case OP_GREATER_NUM:
+  case OP_LESS_NUM:
+  case OP_GREATER_EQUAL_NUM:
+  case OP_LESS_EQUAL_NUM:
+    return {2, 1};
+  case OP_RETURN:
+  case OP_LOCAL_ADD_CONST:
+    return {0, 0};
+  }
+  std::unreachable();
+}
+
+// Checks that every instruction is whole and that its operands are in range:
+// constants and globals against the file's tables, locals against the values
+// on the stack when it runs. Bytecode has no jumps, so following the stack
+// depth through it in order gives that exactly. This keeps a corrupt file
+// from indexing out of bounds through an operand or popping an empty stack;
+// it is not a full bytecode verifier.
+bool checkCode(std::span<const uint8_t> code, size_t constantCount,
+               size_t globalCount) {
+  if (code.empty() || code.back() != OP_RETURN)
+    return false;
+
+  size_t depth = 0;
+  for (size_t offset = 0; offset < code.size();) {
+    uint8_t op = code[offset];
+    if (op >= OPCODE_COUNT || isQuickened(op))
+      return false;
+    size_t size = instructionSize(op);
+    if (offset + size > code.size())
+      return false;
+
+    size_t operand = 0;
+    if (size == 4) {
+      operand = code[offset + 1] | (code[offset + 2] << 8) |
+                (code[offset + 3] << 16);
+    } else if (size > 1) {
+      operand = code[offset + 1];
+    }
+
+    StackEffect effect = stackEffect(static_cast<OpCode>(op));
+    if (effect.pops > depth)
+      return false;
+
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_ADD_CONST:
+      if (operand >= constantCount)
+        return false;
+      break;
+    case OP_LOCAL_ADD_CONST:
+      if (operand >= depth || code[offset + 2] >= constantCount)
+        return false;
+      break;
+    // A local lives below whatever the instruction works on.
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_POP:
+    case OP_GET_LOCAL_LONG:
+    case OP_SET_LOCAL_LONG:
+      if (operand >= depth - effect.pops)
+        return false;
+      break;
+    default:
+      break;
+    }
+
+    if (isGlobalInstruction(op) && operand >= globalCount)
+      return false;
+
+    depth = depth - effect.pops + effect.pushes;
+    offset += size;
+  }
+  return true;
+}
+
+} // namespace
+
+uint64_t hashSource(std::string_view source) { return fnv1a(source); }
+
+std::string serializeScript(const Script &script, uint64_t sourceHash) {
+  std::string out;
+  Writer writer(out);
+
+  out.append(LOXC_MAGIC.data(), LOXC_MAGIC.size());
+  writer.put(LOXC_VERSION);
+  writer.put(BUILD_FINGERPRINT);
+  writer.put(sourceHash);
+
+  const std::vector<uint8_t> &code = script.getCode();
+  writer.putBytes({reinterpret_cast<const char *>(code.data()), code.size()});
+  std::span<const uint8_t> runs = script.getLines().runs();
+  writer.putBytes({reinterpret_cast<const char *>(runs.data()), runs.size()});
+
+  writer.put(static_cast<uint32_t>(script.getConstants().size()));
+  for (const Script::Constant &constant : script.getConstants()) {
+    if (const double *number = std::get_if<double>(&constant)) {
+      writer.put(CONSTANT_NUMBER);
+      writer.put(*number);
+    } else {
+      writer.put(CONSTANT_STRING);
+      writer.putBytes(std::get<std::string>(constant));
+    }
+  }
+
+  writer.put(static_cast<uint32_t>(script.getGlobalNames().size()));
+  for (const std::string &name : script.getGlobalNames()) {
+    writer.putBytes(name);
+  }
+
+  return out;
+}
+
+std::shared_ptr<const Script> loadScript(std::span<const std::byte> data,
+                                         std::optional<uint64_t> sourceHash) {
+  Reader reader(data);
+
+  std::array<char, 4> magic{};
+  uint32_t version = 0;
+  uint64_t build = 0;
+  uint64_t hash = 0;
+  if (!reader.get(magic) || magic != LOXC_MAGIC || !reader.get(version) ||
+      version != LOXC_VERSION || !reader.get(build) ||
+      build != BUILD_FINGERPRINT || !reader.get(hash) ||
+      (sourceHash && hash != *sourceHash))
+    return nullptr;
+
+  std::span<const std::byte> codeBytes;
+  std::span<const std::byte> runBytes;
+  if (!reader.getBytes(codeBytes) || !reader.getBytes(runBytes))
+    return nullptr;
+
+  uint32_t constantCount = 0;
+  if (!reader.get(constantCount))
+    return nullptr;
+  std::vector<Script::Constant> constants;
+  // Pools are written deduplicated, and linking relies on that.
+  std::unordered_set<uint64_t> numbers;
+  std::unordered_set<std::string_view> strings;
+  for (uint32_t i = 0; i < constantCount; i++) {
+    uint8_t tag = 0;
+    if (!reader.get(tag))
+      return nullptr;
+
+    if (tag == CONSTANT_NUMBER) {
+      double number = 0;
+      if (!reader.get(number) ||
+          !numbers.insert(std::bit_cast<uint64_t>(number)).second)
+        return nullptr;
+      constants.emplace_back(number);
+    } else if (tag == CONSTANT_STRING) {
+      std::span<const std::byte> chars;
+      if (!reader.getBytes(chars) || !strings.insert(asChars(chars)).second)
+        return nullptr;
+      constants.emplace_back(std::string(asChars(chars)));
+    } else {
+      return nullptr;
+    }
+  }
+
+  uint32_t globalCount = 0;
+  if (!reader.get(globalCount))
+    return nullptr;
+  std::vector<std::string> globalNames;
+  for (uint32_t i = 0; i < globalCount; i++) {
+    std::span<const std::byte> name;
+    if (!reader.getBytes(name))
+      return nullptr;
+    globalNames.emplace_back(asChars(name));
+  }
+
+  if (!reader.atEnd())
+    return nullptr;
+
+  std::span<const uint8_t> code{
+      reinterpret_cast<const uint8_t *>(codeBytes.data()), codeBytes.size()};
+  LineTable lines;
+  if (!checkCode(code, constantCount, globalCount) ||
+      !lines.assign({reinterpret_cast<const uint8_t *>(runBytes.data()),
+                     runBytes.size()},
+                    code.size()))
+    return nullptr;
+
+  // The Script outlives `data`, so it keeps its own copy of the code and
+  // strings; linking copies them once more, into a chunk the VM can quicken.
+  return std::make_shared<const Script>(
+      std::vector<uint8_t>(code.begin(), code.end()), std::move(lines),
+      std::move(constants), std::move(globalNames));
+}
+} // namespace clox
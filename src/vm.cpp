@@ -1,142 +1,643 @@
 #include "vm.hpp"
 #include "common.hpp"
 #include "compiler.hpp"
+#include "optimizer.hpp"
 
+#include <algorithm>
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Labels-as-values are a GNU extension; every other compiler gets the switch.
+#if defined(COMPUTED_GOTO) && defined(__GNUC__)
+#define THREADED_DISPATCH
+#endif
 
 namespace clox {
 
+namespace {
+
+// The *_LONG form of a global instruction with a one-byte operand. There is no
+// long OP_SET_GLOBAL_POP, so it becomes an OP_SET_GLOBAL_LONG and an OP_POP.
+uint8_t widenGlobalInstruction(uint8_t instruction) {
+  switch (instruction) {
+  case OP_GET_GLOBAL:
+    return OP_GET_GLOBAL_LONG;
+  case OP_DEFINE_GLOBAL:
+    return OP_DEFINE_GLOBAL_LONG;
+  default:
+    return OP_SET_GLOBAL_LONG;
+  }
+}
+} // namespace
+
 InterpretResult VM::interpret(const char *source) {
-  chunk = Chunk(allocator);
+  if (!compile(source)) {
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  return execute();
+}
+
+bool VM::compile(const char *source) {
+  chunk = Chunk(allocatorFor(MEMORY_CHUNK));
+  linked.reset();
   Emitter emitter(source, *this);
 
   if (!emitter.compile()) {
-    return INTERPRET_COMPILE_ERROR;
+    return false;
+  }
+
+  if (optimize) {
+    Peephole(chunk).run();
   }
 
+  return true;
+}
+
+InterpretResult VM::execute() {
   ip = 0;
 
-  return run();
+  InterpretResult result = run();
+  // Hosts and the REPL write to stdout between runs too.
+  output.flush();
+  return result;
 }
 
-InterpretResult VM::run() {
-  for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    std::print("          ");
-    if (stack.empty()) {
-      std::print("<empty>");
+std::shared_ptr<const Script> VM::compileScript(const char *source) {
+  if (!compile(source)) {
+    return nullptr;
+  }
+
+  std::span<const uint8_t> code = chunk.codeBytes();
+  LineTable lines;
+  lines.assign(chunk.getLines().runs(), code.size());
+
+  // The script names only the globals it uses, numbered from 0 by first use.
+  // Those behind one-byte operands are numbered first, so their operands
+  // still fit.
+  std::vector<uint8_t> scriptCode(code.begin(), code.end());
+  std::unordered_map<size_t, size_t> indices;
+  std::vector<std::string> names;
+  for (bool wide : {false, true}) {
+    for (size_t offset = 0; offset < code.size();
+         offset += instructionSize(code[offset])) {
+      uint8_t op = code[offset];
+      size_t size = instructionSize(op);
+      if (!isGlobalInstruction(op) || (size == 4) != wide)
+        continue;
+
+      size_t slot = wide ? chunk.getLong(offset + 1) : code[offset + 1];
+      auto [it, inserted] = indices.try_emplace(slot, names.size());
+      if (inserted)
+        names.emplace_back(globalNames[slot]->getString());
+      for (size_t i = 1; i < size; i++) {
+        scriptCode[offset + i] =
+            static_cast<uint8_t>(it->second >> (8 * (i - 1)));
+      }
     }
-    for (Value value : stack) {
-      std::print("[ {} ]", value);
+  }
+
+  std::vector<Script::Constant> constants;
+  constants.reserve(chunk.constantCount());
+  for (size_t i = 0; i < chunk.constantCount(); i++) {
+    Value constant = chunk.getConstant(i);
+    if (constant.isNumber()) {
+      constants.emplace_back(constant.asNumber());
+    } else {
+      constants.emplace_back(std::string(constant.asString()->getString()));
     }
-    std::println();
-    chunk.disassembleInstruction(ip);
+  }
+
+  // Linking the script back into this VM would rebuild `chunk` as it is.
+  linked = std::make_shared<const Script>(
+      std::move(scriptCode), std::move(lines), std::move(constants),
+      std::move(names));
+  return linked;
+}
+
+InterpretResult VM::execute(const std::shared_ptr<const Script> &script) {
+  if (script != linked && !link(script)) {
+    std::println(std::cerr, "Could not link script.");
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  return execute();
+}
+
+bool VM::link(const std::shared_ptr<const Script> &script) {
+  // The constants are added straight to `chunk` so the collector sees them
+  // while the rest are interned.
+  chunk = Chunk(allocatorFor(MEMORY_CHUNK));
+  linked.reset();
+
+  const std::vector<Script::Constant> &constants = script->getConstants();
+  for (size_t i = 0; i < constants.size(); i++) {
+    Value value = Value::Nil();
+    if (const double *number = std::get_if<double>(&constants[i])) {
+      value = Value::Number(*number);
+    } else {
+      value = Value::Object(copyString(std::get<std::string>(constants[i])));
+    }
+
+    push(value);
+    size_t index = chunk.addConstant(value);
+    pop();
+    // Scripts are built from deduplicated pools, so anything else is corrupt.
+    if (index != i)
+      return false;
+  }
+
+  std::vector<size_t> slots;
+  slots.reserve(script->getGlobalNames().size());
+  for (const std::string &name : script->getGlobalNames()) {
+    slots.push_back(globalSlot(copyString(name)));
+  }
+
+  // An instruction with a one-byte operand is widened to its *_LONG form
+  // when this VM's slot for the global does not fit. That moves everything
+  // after it, so the line table then has to be rebuilt byte by byte.
+  const std::vector<uint8_t> &source = script->getCode();
+  const LineTable &sourceLines = script->getLines();
+  bool widen = false;
+  for (size_t offset = 0; offset < source.size();
+       offset += instructionSize(source[offset])) {
+    uint8_t op = source[offset];
+    if (isGlobalInstruction(op) && instructionSize(op) == 2 &&
+        slots[source[offset + 1]] > UINT8_MAX)
+      widen = true;
+  }
+
+  std::pmr::vector<uint8_t> code(chunk.get_allocator());
+  code.reserve(source.size());
+  LineTable lines(chunk.get_allocator());
+  // Appends `byte`, which comes from the instruction byte at `from`.
+  auto emit = [&](uint8_t byte, size_t from) {
+    code.push_back(byte);
+    if (widen)
+      lines.add(sourceLines.getLocation(from));
+  };
+
+  for (size_t offset = 0; offset < source.size();) {
+    uint8_t op = source[offset];
+    size_t size = instructionSize(op);
+    if (!isGlobalInstruction(op)) {
+      for (size_t i = 0; i < size; i++) {
+        emit(source[offset + i], offset + i);
+      }
+      offset += size;
+      continue;
+    }
+
+    size_t operand = source[offset + 1];
+    if (size == 4)
+      operand |= (source[offset + 2] << 8) | (source[offset + 3] << 16);
+    size_t slot = slots[operand];
+    if (slot >= UINT24_COUNT)
+      return false;
+    if (size == 2 && slot <= UINT8_MAX) {
+      emit(op, offset);
+      emit(static_cast<uint8_t>(slot), offset + 1);
+    } else {
+      emit(size == 4 ? op : widenGlobalInstruction(op), offset);
+      for (size_t i = 0; i < 3; i++) {
+        emit(static_cast<uint8_t>(slot >> (8 * i)),
+             offset + std::min(i + 1, size - 1));
+      }
+      if (op == OP_SET_GLOBAL_POP)
+        emit(OP_POP, offset + 1);
+    }
+    offset += size;
+  }
+
+  if (!widen && !lines.assign(sourceLines.runs(), code.size()))
+    return false;
+
+  chunk.replaceCode(std::move(code), std::move(lines));
+  linked = script;
+  return true;
+}
+
+void VM::defineGlobal(std::string_view name, Value value) {
+  // Interning the name and growing the globals can collect.
+  push(value);
+  defineGlobal(globalSlot(copyString(name)));
+}
+
+std::optional<Value> VM::findGlobal(std::string_view name) const {
+  ObjString *key = strings.findString(name, hashString(name));
+  if (key == nullptr)
+    return std::nullopt;
+  Value *slot = globalSlots.find(key);
+  if (slot == nullptr)
+    return std::nullopt;
+
+  const Global &global = globals[static_cast<size_t>(slot->asNumber())];
+  if (!global.defined)
+    return std::nullopt;
+  return global.value;
+}
+
+bool VM::growStack() {
+  if (stackCapacity >= stackMax) {
+    runtimeError("Stack overflow.");
+    return false;
+  }
+
+  // Growing can collect, which walks the old stack up to stackTop, so that
+  // has to stay put until the values have moved.
+  stackCapacity = std::min(stackCapacity * 2, stackMax);
+  if (stackCapacity + ROOT_SLOTS > stack.size()) {
+    auto depth = static_cast<size_t>(stackTop - stack.data());
+    stack.resize(stackCapacity + ROOT_SLOTS, Value::Nil());
+    stackTop = stack.data() + depth;
+  }
+  return true;
+}
+
+void VM::traceInstruction() const {
+  std::print("          ");
+  if (stackTop == stack.data()) {
+    std::print("<empty>");
+  }
+  for (const Value *slot = stack.data(); slot < stackTop; slot++) {
+    std::print("[ {} ]", *slot);
+  }
+  std::println();
+  chunk.disassembleInstruction(ip);
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION() traceInstruction()
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif
+
+#define INSTRUMENT() instrument.instruction(ip, chunk.getCode(ip))
+
+// Both dispatch loops share the handler bodies below. A handler ends with
+// DISPATCH(), which either jumps straight to the next handler through the
+// label table or goes back around the switch loop.
+#ifdef THREADED_DISPATCH
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    TRACE_INSTRUCTION();                                                       \
+    INSTRUMENT();                                                              \
+    goto *dispatchTable[readByte()];                                           \
+  } while (false)
+#define CASE(op) L_##op
+#else
+#define DISPATCH() continue
+#define CASE(op) case op
 #endif
-    InterpretResult flag = INTERPRET_OK;
+
+InterpretResult VM::run() {
+  if (profiler != nullptr) {
+    profiler->start(chunk);
+    InterpretResult result = run(*profiler);
+    profiler->finish(chunk);
+    return result;
+  }
+
+  if (sampler != nullptr) {
+    sampler->start(chunk);
+    InterpretResult result = run(*sampler);
+    sampler->finish(chunk);
+    return result;
+  }
+
+  NoProfiler none;
+  return run(none);
+}
+
+template <class Instrument>
+InterpretResult VM::run(Instrument &instrument) {
+  // The fused comparisons are spelled as the negations they replace so NaN
+  // compares the same way.
+  auto greaterEqual = [](double a, double b) { return !(a < b); };
+  auto lessEqual = [](double a, double b) { return !(a > b); };
+
+#ifdef THREADED_DISPATCH
+  // clang-format off
+  static void *const dispatchTable[] = {
+      [OP_CONSTANT]           = &&L_OP_CONSTANT,
+      [OP_NIL]                = &&L_OP_NIL,
+      [OP_TRUE]               = &&L_OP_TRUE,
+      [OP_FALSE]              = &&L_OP_FALSE,
+      [OP_POP]                = &&L_OP_POP,
+      [OP_GET_LOCAL]          = &&L_OP_GET_LOCAL,
+      [OP_SET_LOCAL]          = &&L_OP_SET_LOCAL,
+      [OP_GET_GLOBAL]         = &&L_OP_GET_GLOBAL,
+      [OP_DEFINE_GLOBAL]      = &&L_OP_DEFINE_GLOBAL,
+      [OP_SET_GLOBAL]         = &&L_OP_SET_GLOBAL,
+      [OP_EQUAL]              = &&L_OP_EQUAL,
+      [OP_GREATER]            = &&L_OP_GREATER,
+      [OP_LESS]               = &&L_OP_LESS,
+      [OP_ADD]                = &&L_OP_ADD,
+      [OP_SUBTRACT]           = &&L_OP_SUBTRACT,
+      [OP_MULTIPLY]           = &&L_OP_MULTIPLY,
+      [OP_DIVIDE]             = &&L_OP_DIVIDE,
+      [OP_NOT]                = &&L_OP_NOT,
+      [OP_NEGATE]             = &&L_OP_NEGATE,
+      [OP_PRINT]              = &&L_OP_PRINT,
+      [OP_RETURN]             = &&L_OP_RETURN,
+      [OP_CONSTANT_LONG]      = &&L_OP_CONSTANT_LONG,
+      [OP_GET_LOCAL_LONG]     = &&L_OP_GET_LOCAL_LONG,
+      [OP_SET_LOCAL_LONG]     = &&L_OP_SET_LOCAL_LONG,
+      [OP_GET_GLOBAL_LONG]    = &&L_OP_GET_GLOBAL_LONG,
+      [OP_DEFINE_GLOBAL_LONG] = &&L_OP_DEFINE_GLOBAL_LONG,
+      [OP_SET_GLOBAL_LONG]    = &&L_OP_SET_GLOBAL_LONG,
+      [OP_NOT_EQUAL]          = &&L_OP_NOT_EQUAL,
+      [OP_GREATER_EQUAL]      = &&L_OP_GREATER_EQUAL,
+      [OP_LESS_EQUAL]         = &&L_OP_LESS_EQUAL,
+      [OP_ADD_CONST]          = &&L_OP_ADD_CONST,
+      [OP_SET_LOCAL_POP]      = &&L_OP_SET_LOCAL_POP,
+      [OP_SET_GLOBAL_POP]     = &&L_OP_SET_GLOBAL_POP,
+      [OP_LOCAL_ADD_CONST]    = &&L_OP_LOCAL_ADD_CONST,
+      [OP_ADD_NUM]            = &&L_OP_ADD_NUM,
+      [OP_ADD_STR]            = &&L_OP_ADD_STR,
+      [OP_SUBTRACT_NUM]       = &&L_OP_SUBTRACT_NUM,
+      [OP_MULTIPLY_NUM]       = &&L_OP_MULTIPLY_NUM,
+      [OP_DIVIDE_NUM]         = &&L_OP_DIVIDE_NUM,
+      [OP_GREATER_NUM]        = &&L_OP_GREATER_NUM,
+      [OP_LESS_NUM]           = &&L_OP_LESS_NUM,
+      [OP_GREATER_EQUAL_NUM]  = &&L_OP_GREATER_EQUAL_NUM,
+      [OP_LESS_EQUAL_NUM]     = &&L_OP_LESS_EQUAL_NUM,
+  };
+  // clang-format on
+
+  DISPATCH();
+#else
+  for (;;) {
+    TRACE_INSTRUCTION();
+    INSTRUMENT();
     auto instruction = static_cast<OpCode>(readByte());
     switch (instruction) {
-    case OP_CONSTANT:
-      push(readConstant());
-      break;
-    case OP_NIL:
-      push(Value::Nil());
-      break;
-    case OP_TRUE:
-      push(Value::Bool(true));
-      break;
-    case OP_FALSE:
-      push(Value::Bool(false));
-      break;
-    case OP_POP:
-      pop();
-      break;
-    case OP_GET_LOCAL: {
-      uint8_t slot = readByte();
-      push(stack[slot]);
-      break;
-    }
-    case OP_SET_LOCAL: {
-      uint8_t slot = readByte();
-      stack[slot] = peek(0);
-      break;
-    }
-    case OP_GET_GLOBAL: {
-      ObjString *name = readString();
-      if (auto it = globals.find(name); it != globals.end()) {
-        push(it->second);
-        break;
-      }
-      runtimeError("Undefined variable '{}'.", name->getString());
+#endif
+  CASE(OP_CONSTANT):
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(readConstant());
+    DISPATCH();
+  CASE(OP_NIL):
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(Value::Nil());
+    DISPATCH();
+  CASE(OP_TRUE):
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(Value::Bool(true));
+    DISPATCH();
+  CASE(OP_FALSE):
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(Value::Bool(false));
+    DISPATCH();
+  CASE(OP_POP):
+    pop();
+    DISPATCH();
+  CASE(OP_GET_LOCAL): {
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    uint8_t slot = readByte();
+    push(stack[slot]);
+    DISPATCH();
+  }
+  CASE(OP_SET_LOCAL): {
+    uint8_t slot = readByte();
+    stack[slot] = peek(0);
+    DISPATCH();
+  }
+  CASE(OP_GET_GLOBAL):
+    if (!checkStack() || !getGlobal(readByte()))
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_DEFINE_GLOBAL):
+    defineGlobal(readByte());
+    DISPATCH();
+  CASE(OP_SET_GLOBAL):
+    if (!setGlobal(readByte(), peek(0)))
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_EQUAL):
+    push(Value::Bool(popEqual()));
+    DISPATCH();
+  // The generic arithmetic and comparison handlers quicken themselves before
+  // doing the work, so only their first execution (and the first after a
+  // failed guard) pays for checking the types in full.
+  CASE(OP_GREATER):
+    quickenNumbers(OP_GREATER_NUM);
+    if (binaryOp(Value::Bool, std::greater()) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_LESS):
+    quickenNumbers(OP_LESS_NUM);
+    if (binaryOp(Value::Bool, std::less()) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_ADD):
+    if (peek(0).isNumber() && peek(1).isNumber())
+      rewrite(OP_ADD_NUM);
+    else if (peek(0).isText() && peek(1).isText())
+      rewrite(OP_ADD_STR);
+    if (!add())
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_SUBTRACT):
+    quickenNumbers(OP_SUBTRACT_NUM);
+    if (binaryOp(Value::Number, std::minus()) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_MULTIPLY):
+    quickenNumbers(OP_MULTIPLY_NUM);
+    if (binaryOp(Value::Number, std::multiplies()) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_DIVIDE):
+    quickenNumbers(OP_DIVIDE_NUM);
+    if (binaryOp(Value::Number, std::divides()) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_NOT):
+    push(Value::Bool(pop().isFalsey()));
+    DISPATCH();
+  CASE(OP_NEGATE):
+    if (!peek(0).isNumber()) {
+      runtimeError("Operand must be a number.");
       return INTERPRET_RUNTIME_ERROR;
     }
-    case OP_DEFINE_GLOBAL: {
-      ObjString *name = readString();
-      globals.insert_or_assign(name, peek(0));
-      pop();
-      break;
+    push(Value::Number(-pop().asNumber()));
+    DISPATCH();
+  CASE(OP_PRINT):
+    print(pop());
+    DISPATCH();
+  CASE(OP_RETURN):
+    // Exit interpreter.
+    return INTERPRET_OK;
+  CASE(OP_CONSTANT_LONG):
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(chunk.getConstant(readLong()));
+    DISPATCH();
+  CASE(OP_GET_LOCAL_LONG): {
+    uint32_t slot = readLong();
+    if (!checkLocal(slot) || !checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(stack[slot]);
+    DISPATCH();
+  }
+  CASE(OP_SET_LOCAL_LONG): {
+    uint32_t slot = readLong();
+    if (!checkLocal(slot))
+      return INTERPRET_RUNTIME_ERROR;
+    stack[slot] = peek(0);
+    DISPATCH();
+  }
+  CASE(OP_GET_GLOBAL_LONG):
+    if (!checkStack() || !getGlobal(readLong()))
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_DEFINE_GLOBAL_LONG):
+    defineGlobal(readLong());
+    DISPATCH();
+  CASE(OP_SET_GLOBAL_LONG):
+    if (!setGlobal(readLong(), peek(0)))
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_NOT_EQUAL):
+    push(Value::Bool(!popEqual()));
+    DISPATCH();
+  CASE(OP_GREATER_EQUAL):
+    quickenNumbers(OP_GREATER_EQUAL_NUM);
+    if (binaryOp(Value::Bool, greaterEqual) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_LESS_EQUAL):
+    quickenNumbers(OP_LESS_EQUAL_NUM);
+    if (binaryOp(Value::Bool, lessEqual) != INTERPRET_OK)
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  CASE(OP_ADD_CONST): {
+    Value constant = readConstant();
+    if (peek(0).isNumber() && constant.isNumber()) {
+      stackTop[-1] = Value::Number(peek(0).asNumber() + constant.asNumber());
+      DISPATCH();
+    }
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(constant);
+    if (!add())
+      return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  }
+  CASE(OP_SET_LOCAL_POP): {
+    uint8_t slot = readByte();
+    stack[slot] = pop();
+    DISPATCH();
+  }
+  CASE(OP_SET_GLOBAL_POP):
+    if (!setGlobal(readByte(), peek(0)))
+      return INTERPRET_RUNTIME_ERROR;
+    pop();
+    DISPATCH();
+  CASE(OP_LOCAL_ADD_CONST): {
+    uint8_t slot = readByte();
+    Value constant = readConstant();
+    Value local = stack[slot];
+    if (local.isNumber() && constant.isNumber()) {
+      stack[slot] = Value::Number(local.asNumber() + constant.asNumber());
+      DISPATCH();
     }
-    case OP_SET_GLOBAL: {
-      ObjString *name = readString();
-      if (!globals.contains(name)) {
-        runtimeError("Undefined variable '{}'.", name->getString());
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(local);
+    if (!checkStack())
+      return INTERPRET_RUNTIME_ERROR;
+    push(constant);
+    if (!add())
+      return INTERPRET_RUNTIME_ERROR;
+    stack[slot] = pop();
+    DISPATCH();
+  }
+  // A failed guard means the operands are not what the instruction was
+  // quickened for. The generic handler takes over, including reporting any
+  // type error, and will quicken again for whatever it sees next time.
+  CASE(OP_ADD_NUM):
+    if (!numberOp(Value::Number, std::plus())) {
+      rewrite(OP_ADD);
+      if (!add())
         return INTERPRET_RUNTIME_ERROR;
-      }
-      globals.insert_or_assign(name, peek(0));
-      break;
-    }
-    case OP_EQUAL: {
-      Value b = pop();
-      Value a = pop();
-      push(Value::Bool(a == b));
-      break;
-    }
-    case OP_GREATER:
-      flag = binaryOp(Value::Bool, std::greater());
-      break;
-    case OP_LESS:
-      flag = binaryOp(Value::Bool, std::less());
-      break;
-    case OP_ADD: {
-      if (peek(0).isString() && peek(1).isString()) {
-        ObjString *b = pop().asString();
-        ObjString *a = pop().asString();
-        ObjString *result = takeString(a->getString() + b->getString());
-        push(Value::Object(result));
-      } else if (peek(0).isNumber() && peek(1).isNumber()) {
-        double b = pop().asNumber();
-        double a = pop().asNumber();
-        push(Value::Number(a + b));
-      }
-      break;
-    }
-    case OP_SUBTRACT:
-      flag = binaryOp(Value::Number, std::minus());
-      break;
-    case OP_MULTIPLY:
-      flag = binaryOp(Value::Number, std::multiplies());
-      break;
-    case OP_DIVIDE:
-      flag = binaryOp(Value::Number, std::divides());
-      break;
-    case OP_NOT:
-      push(Value::Bool(pop().isFalsey()));
-      break;
-    case OP_NEGATE:
-      if (!peek(0).isNumber()) {
-        runtimeError("Operand must be a number.");
+    }
+    DISPATCH();
+  CASE(OP_ADD_STR):
+    if (peek(0).isText() && peek(1).isText()) [[likely]] {
+      addText();
+    } else {
+      rewrite(OP_ADD);
+      if (!add())
         return INTERPRET_RUNTIME_ERROR;
-      }
-      push(Value::Number(-pop().asNumber()));
-      break;
-    case OP_PRINT:
-      std::println("{}", pop());
-      break;
-    case OP_RETURN:
-      // Exit interpreter.
-      return INTERPRET_OK;
-    }
-    if (flag != INTERPRET_OK)
-      return flag;
+    }
+    DISPATCH();
+  CASE(OP_SUBTRACT_NUM):
+    if (!numberOp(Value::Number, std::minus())) {
+      rewrite(OP_SUBTRACT);
+      if (binaryOp(Value::Number, std::minus()) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+  CASE(OP_MULTIPLY_NUM):
+    if (!numberOp(Value::Number, std::multiplies())) {
+      rewrite(OP_MULTIPLY);
+      if (binaryOp(Value::Number, std::multiplies()) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+  CASE(OP_DIVIDE_NUM):
+    if (!numberOp(Value::Number, std::divides())) {
+      rewrite(OP_DIVIDE);
+      if (binaryOp(Value::Number, std::divides()) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+  CASE(OP_GREATER_NUM):
+    if (!numberOp(Value::Bool, std::greater())) {
+      rewrite(OP_GREATER);
+      if (binaryOp(Value::Bool, std::greater()) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+  CASE(OP_LESS_NUM):
+    if (!numberOp(Value::Bool, std::less())) {
+      rewrite(OP_LESS);
+      if (binaryOp(Value::Bool, std::less()) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+  CASE(OP_GREATER_EQUAL_NUM):
+    if (!numberOp(Value::Bool, greaterEqual)) {
+      rewrite(OP_GREATER_EQUAL);
+      if (binaryOp(Value::Bool, greaterEqual) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+  CASE(OP_LESS_EQUAL_NUM):
+    if (!numberOp(Value::Bool, lessEqual)) {
+      rewrite(OP_LESS_EQUAL);
+      if (binaryOp(Value::Bool, lessEqual) != INTERPRET_OK)
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    DISPATCH();
+#ifndef THREADED_DISPATCH
+    }
   }
+#endif
 }
+
+#undef CASE
+#undef DISPATCH
+#undef INSTRUMENT
+#undef TRACE_INSTRUCTION
 } // namespace clox
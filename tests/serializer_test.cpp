@@ -0,0 +1,248 @@
+// Round-trips compiled scripts through the .loxc format, and checks that the
+// loader turns away files that are cut short, written for another build or
+// patched to point an operand out of range.
+
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.hpp"
+#include "serializer.hpp"
+#include "vm.hpp"
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, std::string_view what) {
+  if (condition)
+    return;
+  std::println(std::cerr, "FAILED: {}", what);
+  failures++;
+}
+
+std::shared_ptr<const clox::Script>
+load(std::string_view file, std::optional<uint64_t> sourceHash = std::nullopt) {
+  return clox::loadScript(std::as_bytes(std::span(file)), sourceHash);
+}
+
+// What `script` prints when run on a VM of its own.
+std::string run(const std::shared_ptr<const clox::Script> &script) {
+  clox::VM vm;
+  std::string output;
+  vm.setPrintSink([&output](std::string_view text) { output += text; });
+  if (vm.execute(script) != clox::INTERPRET_OK)
+    output += "<error>";
+  return output;
+}
+
+// A script compiled from `source`, and the file it serializes to.
+struct Compiled {
+  std::shared_ptr<const clox::Script> script;
+  uint64_t sourceHash = 0;
+  std::string file;
+  // Where the script's code starts in `file`.
+  size_t code = std::string::npos;
+
+  explicit Compiled(const std::string &source) {
+    clox::VM vm;
+    script = vm.compileScript(source.c_str());
+    if (!script)
+      return;
+    sourceHash = clox::hashSource(source);
+    file = clox::serializeScript(*script, sourceHash);
+    const std::vector<uint8_t> &bytes = script->getCode();
+    code = file.find(std::string_view(
+        reinterpret_cast<const char *>(bytes.data()), bytes.size()));
+  }
+
+  [[nodiscard]] bool valid() const {
+    return script != nullptr && code != std::string::npos;
+  }
+
+  // The offset in the code of the last `op`, if there is one.
+  [[nodiscard]] std::optional<size_t> findLast(uint8_t op) const {
+    std::optional<size_t> found;
+    const std::vector<uint8_t> &bytes = script->getCode();
+    for (size_t offset = 0; offset < bytes.size();
+         offset += clox::instructionSize(bytes[offset])) {
+      if (bytes[offset] == op)
+        found = offset;
+    }
+    return found;
+  }
+
+  // `file` with the opcode at `offset` in the code replaced by `op`.
+  [[nodiscard]] std::string withOpcode(size_t offset, uint8_t op) const {
+    std::string patched = file;
+    patched[code + offset] = static_cast<char>(op);
+    return patched;
+  }
+
+  // `file` with the first operand of the instruction at `offset` in the code
+  // replaced by `operand`.
+  [[nodiscard]] std::string withOperand(size_t offset, size_t operand) const {
+    std::string patched = file;
+    size_t width =
+        clox::instructionSize(script->getCode()[offset]) == 4 ? 3 : 1;
+    for (size_t i = 1; i <= width; i++) {
+      patched[code + offset + i] = static_cast<char>(operand & 0xff);
+      operand >>= 8;
+    }
+    return patched;
+  }
+};
+
+std::string manyLocals(int count) {
+  std::string source = "{\n  var l0 = 0;\n";
+  for (int i = 1; i < count; i++) {
+    source += std::format("  var l{} = l{} + 1;\n", i, i - 1);
+  }
+  source += std::format("  print l{};\n}}\n", count - 1);
+  return source;
+}
+
+void testRoundTrip() {
+  const std::string sources[] = {
+      "print 1; print \"two\"; print nil; print !true;",
+      "var a = 1;\nvar b = a + 2;\na = b * 10;\nprint a;\nprint b;\n",
+      "var s = \"a piece of a long string, \";\n"
+      "var r = s + s + s + s;\nprint r;\nprint r == s + s + s + s;\n",
+      "{\n  var a = 1;\n  a = a + 2;\n  var b = -a;\n  print a < b;\n}\n",
+      manyLocals(300),
+  };
+
+  for (const std::string &source : sources) {
+    Compiled compiled(source);
+    expect(compiled.valid(), std::format("compiles: {}", source));
+    if (!compiled.valid())
+      continue;
+
+    std::shared_ptr<const clox::Script> loaded =
+        load(compiled.file, compiled.sourceHash);
+    expect(loaded != nullptr, std::format("loads: {}", source));
+    if (!loaded)
+      continue;
+    expect(clox::serializeScript(*loaded, compiled.sourceHash) ==
+               compiled.file,
+           std::format("serializes back the same: {}", source));
+    expect(run(loaded) == run(compiled.script),
+           std::format("runs the same: {}", source));
+  }
+}
+
+void testHeader() {
+  Compiled compiled("var a = \"header\"; print a;");
+  expect(compiled.valid(), "header script compiles");
+  if (!compiled.valid())
+    return;
+
+  expect(load(compiled.file) != nullptr, "loads without a source hash");
+  expect(load(compiled.file, compiled.sourceHash + 1) == nullptr,
+         "rejects a different source hash");
+
+  // The magic, then the version and the build fingerprint.
+  for (size_t offset : {0, 4, 8}) {
+    std::string patched = compiled.file;
+    patched[offset] = static_cast<char>(patched[offset] ^ 1);
+    expect(load(patched) == nullptr,
+           std::format("rejects a changed header byte {}", offset));
+  }
+
+  expect(load(compiled.file + '\0') == nullptr, "rejects trailing bytes");
+}
+
+void testTruncated() {
+  Compiled compiled("var a = 1; { var b = \"local\"; print b + \"!\"; }");
+  expect(compiled.valid(), "truncated script compiles");
+  if (!compiled.valid())
+    return;
+
+  for (size_t size = 0; size < compiled.file.size(); size++) {
+    expect(load(std::string_view(compiled.file).substr(0, size)) == nullptr,
+           std::format("rejects the first {} of {} bytes", size,
+                       compiled.file.size()));
+  }
+}
+
+// Patches the last `op` in the script compiled from `source` to have
+// `operand`, and expects the result to load only if `accepted`.
+void expectOperand(const std::string &source, uint8_t op, size_t operand,
+                   bool accepted) {
+  std::string what = std::format("{} {} in {}", clox::OPCODE_NAMES[op],
+                                 operand, source.substr(0, 40));
+  Compiled compiled(source);
+  std::optional<size_t> offset =
+      compiled.valid() ? compiled.findLast(op) : std::nullopt;
+  expect(offset.has_value(), std::format("emits {}", what));
+  if (!offset)
+    return;
+
+  bool loaded = load(compiled.withOperand(*offset, operand)) != nullptr;
+  expect(loaded == accepted,
+         std::format("{} {}", accepted ? "accepts" : "rejects", what));
+}
+
+void testOperands() {
+  expectOperand("print 1;", clox::OP_CONSTANT, 0, true);
+  expectOperand("print 1;", clox::OP_CONSTANT, 1, false);
+  expectOperand("var a = 1; print a;", clox::OP_GET_GLOBAL, 0, true);
+  expectOperand("var a = 1; print a;", clox::OP_GET_GLOBAL, 1, false);
+  expectOperand("var a = 1; print a;", clox::OP_DEFINE_GLOBAL, 1, false);
+
+  expectOperand("{ var a = 1; print a; }", clox::OP_GET_LOCAL, 0, true);
+  expectOperand("{ var a = 1; print a; }", clox::OP_GET_LOCAL, 1, false);
+  expectOperand("{ var a = 1; a = 2; }", clox::OP_SET_LOCAL_POP, 0, true);
+  // The slot of the value being stored is not a local.
+  expectOperand("{ var a = 1; a = 2; }", clox::OP_SET_LOCAL_POP, 1, false);
+  expectOperand("{ var a = 1; a = a + 2; }", clox::OP_LOCAL_ADD_CONST, 0,
+                true);
+  expectOperand("{ var a = 1; a = a + 2; }", clox::OP_LOCAL_ADD_CONST, 1,
+                false);
+
+  std::string locals = manyLocals(300);
+  expectOperand(locals, clox::OP_GET_LOCAL_LONG, 299, true);
+  expectOperand(locals, clox::OP_GET_LOCAL_LONG, 300, false);
+  expectOperand(locals, clox::OP_GET_LOCAL_LONG, 65520, false);
+}
+
+void testOpcodes() {
+  Compiled compiled("print nil;");
+  std::optional<size_t> nil =
+      compiled.valid() ? compiled.findLast(clox::OP_NIL) : std::nullopt;
+  std::optional<size_t> print =
+      compiled.valid() ? compiled.findLast(clox::OP_PRINT) : std::nullopt;
+  expect(nil && print, "emits OP_NIL and OP_PRINT");
+  if (!nil || !print)
+    return;
+
+  expect(load(compiled.withOpcode(*nil, clox::OP_POP)) == nullptr,
+         "rejects popping an empty stack");
+  expect(load(compiled.withOpcode(*print, clox::OP_ADD_NUM)) == nullptr,
+         "rejects a quickened instruction");
+  expect(load(compiled.withOpcode(*print, clox::OPCODE_COUNT)) == nullptr,
+         "rejects an unknown opcode");
+}
+} // namespace
+
+int main() {
+  testRoundTrip();
+  testHeader();
+  testTruncated();
+  testOperands();
+  testOpcodes();
+
+  if (failures > 0) {
+    std::println(std::cerr, "{} check(s) failed.", failures);
+    return 1;
+  }
+  return 0;
+}
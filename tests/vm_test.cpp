@@ -0,0 +1,156 @@
+// Runs scripts on VMs with different stack limits and checks what the value
+// stack and the locals of a block can and cannot hold.
+
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <print>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "chunk.hpp"
+#include "script.hpp"
+#include "vm.hpp"
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, std::string_view what) {
+  if (condition)
+    return;
+  std::println(std::cerr, "FAILED: {}", what);
+  failures++;
+}
+
+struct Run {
+  clox::InterpretResult result;
+  std::string output;
+};
+
+Run interpret(clox::VM &vm, const std::string &source) {
+  Run run{.result = clox::INTERPRET_OK, .output = ""};
+  vm.setPrintSink([&run](std::string_view text) { run.output += text; });
+  run.result = vm.interpret(source.c_str());
+  return run;
+}
+
+// An expression that leaves `depth` values on the stack at its deepest:
+// x + (x + (... + x)).
+std::string nested(int depth) {
+  std::string source = "var x = 1;\nprint ";
+  for (int i = 1; i < depth; i++) {
+    source += "x + (";
+  }
+  source += "x";
+  source += std::string(static_cast<size_t>(depth - 1), ')');
+  source += ";\n";
+  return source;
+}
+
+std::string block(int locals) {
+  std::string source = "{\n";
+  for (int i = 0; i < locals; i++) {
+    source += std::format("  var l{} = {};\n", i, i);
+  }
+  source += std::format("  print l{};\n}}\n", locals - 1);
+  return source;
+}
+
+void testStackLimit() {
+  for (int depth : {40, 1000, 5000}) {
+    clox::VM vm;
+    Run run = interpret(vm, nested(depth));
+    expect(run.result == clox::INTERPRET_OK &&
+               run.output == std::format("{}\n", depth),
+           std::format("grows the stack to {} values", depth));
+  }
+
+  // Overflowing is a runtime error, right at the limit.
+  std::string source = nested(40);
+  for (size_t limit : {0, 10, 39}) {
+    clox::VM vm(limit);
+    expect(interpret(vm, source).result == clox::INTERPRET_RUNTIME_ERROR,
+           std::format("overflows a stack of {}", limit));
+  }
+  for (size_t limit : {40, 41}) {
+    clox::VM vm(limit);
+    expect(interpret(vm, source).result == clox::INTERPRET_OK,
+           std::format("fits in a stack of {}", limit));
+  }
+
+  // A VM that has grown its stack still runs from the bottom next time.
+  clox::VM vm;
+  interpret(vm, nested(1000));
+  Run again = interpret(vm, "print 1 + 2;");
+  expect(again.output == "3\n", "runs again after growing");
+}
+
+void testLocals() {
+  for (int count : {255, 256, 257, 300, LOCALS_MAX}) {
+    clox::VM vm;
+    Run run = interpret(vm, block(count));
+    expect(run.result == clox::INTERPRET_OK &&
+               run.output == std::format("{}\n", count - 1),
+           std::format("declares {} locals", count));
+  }
+
+  clox::VM vm;
+  expect(interpret(vm, block(LOCALS_MAX + 1)).result ==
+             clox::INTERPRET_COMPILE_ERROR,
+         "rejects more than LOCALS_MAX locals");
+
+  Run shadowed = interpret(vm, "var a = 0;\n"
+                               "{\n"
+                               "  var a = 1;\n"
+                               "  { var a = 2; print a; }\n"
+                               "  print a;\n"
+                               "  { var b = a + 1; print b; }\n"
+                               "}\n"
+                               "print a;\n");
+  expect(shadowed.output == "2\n1\n2\n0\n", "resolves shadowed locals");
+
+  expect(interpret(vm, "{ var a = 1; var a = 2; }").result ==
+             clox::INTERPRET_COMPILE_ERROR,
+         "rejects a redeclared local");
+  expect(interpret(vm, "{ var a = 1; { var a = a; } }").result ==
+             clox::INTERPRET_COMPILE_ERROR,
+         "rejects a local read in its own initializer");
+}
+
+// A script naming a local far past anything on the stack. The compiler and
+// the loader never produce one; the VM still stops it.
+void testLongLocalOutOfRange() {
+  std::vector<uint8_t> code = {clox::OP_NIL, clox::OP_GET_LOCAL_LONG};
+  // Slot 0xfff0, little-endian.
+  code.insert(code.end(), {0xf0, 0xff, 0x00});
+  code.insert(code.end(), {clox::OP_POP, clox::OP_POP, clox::OP_RETURN});
+  clox::LineTable lines;
+  for (size_t i = 0; i < code.size(); i++) {
+    lines.add({.line = 1, .column = 1});
+  }
+  auto script = std::make_shared<const clox::Script>(
+      code, std::move(lines), std::vector<clox::Script::Constant>(),
+      std::vector<std::string>());
+
+  clox::VM vm;
+  expect(vm.execute(script) == clox::INTERPRET_RUNTIME_ERROR,
+         "stops a long local operand past the stack");
+}
+} // namespace
+
+int main() {
+  testStackLimit();
+  testLocals();
+  testLongLocalOutOfRange();
+
+  if (failures > 0) {
+    std::println(std::cerr, "{} check(s) failed.", failures);
+    return 1;
+  }
+  return 0;
+}